@@ -0,0 +1,268 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSemaphore>
+#include <QDebug>
+
+#include "perturbation.h"
+#include "renderthread.h"
+
+namespace
+{
+
+struct View
+{
+    const char* name;
+    //Centers are the sum of two doubles, deep zooms need more precision than one has
+    double centerX;
+    double centerXLow;
+    double centerY;
+    double centerYLow;
+    double scaleFactor;
+};
+
+const View Views[] =
+{
+    //DefaultCenterX/Y and DefaultScale of the example widget
+    {"default", -0.637011, 0, -0.0395159, 0, 0.00403897},
+    //Mostly inside of the main cardioid
+    {"interior", -0.15, 0, 0, 0, 0.0008},
+    //Seahorse valley, the escape time changes on almost every pixel
+    {"boundary", -0.7436438870371587, 0, 0.13182590420531198, 0, 2e-8},
+    //Perturbation deep zooms on the same point
+    {"deep-1e-18", -0.7436438870371587, -3.628952515063387e-17, 0.13182590420531198, -1.2892807754956675e-17, 1e-18},
+    {"deep-1e-28", -0.7436438870371587, -3.628952515063387e-17, 0.13182590420531198, -1.2892807754956675e-17, 1e-28}
+};
+
+struct Settings
+{
+    QSize size = QSize(640, 480);
+    int threadCount = 0;
+    EscapeKernel::InstructionSet instructionSet = EscapeKernel::bestInstructionSet();
+    //Views of the other formulas show other parts of their sets, but cost
+    //the same per iteration as the Mandelbrot set
+    EscapeKernel::Formula formula = EscapeKernel::Mandelbrot;
+    RenderThread::SubdivisionMode subdivision = RenderThread::NoSubdivision;
+    //Off, so the first frame is the first pass
+    int previewBudget = 0;
+};
+
+double perSecond(double amount, qint64 nsecs)
+{
+    return nsecs > 0 ? amount * 1e9 / nsecs : 0;
+}
+
+//Renders the view once with a fresh render thread, so neither the tile cache
+//nor the previous frame can shortcut the work
+QJsonObject runView(const View& view, const Settings& settings)
+{
+    RenderThread thread;
+    thread.setTileCacheSize(0);
+    thread.setInstructionSet(settings.instructionSet);
+    EscapeKernel::Fractal fractal;
+    fractal.formula = settings.formula;
+    thread.setFractal(fractal);
+    thread.setSubdivisionMode(settings.subdivision);
+    thread.setPreviewBudget(settings.previewBudget);
+    if(settings.threadCount > 0)
+    {
+        thread.setThreadCount(settings.threadCount);
+    }
+
+    //Signals are handled right in the render thread, the timer is only read there
+    QElapsedTimer timer;
+    qint64 firstFrame = -1;
+    qint64 iterations = 0;
+    qint64 computedPixels = 0;
+    QJsonArray passes;
+    QSemaphore finished;
+    QObject::connect(&thread, &RenderThread::renderedImage, [&](const QImage&, double)
+    {
+        if(firstFrame < 0)
+        {
+            firstFrame = timer.nsecsElapsed();
+        }
+    });
+    QObject::connect(&thread, &RenderThread::passFinished, [&](const RenderThread::PassStats& stats)
+    {
+        iterations += stats.iterations;
+        computedPixels += stats.computedPixels;
+        QJsonObject pass;
+        pass[QStringLiteral("pass")] = stats.pass;
+        pass[QStringLiteral("maxIterations")] = stats.maxIterations;
+        pass[QStringLiteral("ms")] = stats.nsecs / 1e6;
+        pass[QStringLiteral("computedPixels")] = stats.computedPixels;
+        pass[QStringLiteral("iterations")] = stats.iterations;
+        pass[QStringLiteral("rebases")] = stats.rebases;
+        passes.append(pass);
+        if(stats.pass == RenderThread::PassCount - 1)
+        {
+            finished.release();
+        }
+    });
+
+    timer.start();
+    thread.render(FixedPoint(view.centerX) + FixedPoint(view.centerXLow),
+                  FixedPoint(view.centerY) + FixedPoint(view.centerYLow),
+                  view.scaleFactor, settings.size, 1.0);
+    finished.acquire();
+    const qint64 total = timer.nsecsElapsed();
+
+    const qint64 pixels = qint64(settings.size.width()) * settings.size.height();
+    QJsonObject result;
+    result[QStringLiteral("name")] = QLatin1String(view.name);
+    result[QStringLiteral("scaleFactor")] = view.scaleFactor;
+    //Same choice of the kernel as the render thread makes
+    const EscapeKernel::Precision precision = EscapeKernel::precisionFor(view.centerX, view.centerY, view.scaleFactor,
+                                                                         settings.size.width(), settings.size.height(),
+                                                                         RenderThread::passIterations(
+                                                                             RenderThread::PassCount - 1));
+    result[QStringLiteral("precision")] = settings.formula == EscapeKernel::Mandelbrot &&
+            view.scaleFactor < Perturbation::DeepZoomScale ?
+                QStringLiteral("perturbation") : QString(QLatin1String(EscapeKernel::name(precision)));
+    result[QStringLiteral("totalMs")] = total / 1e6;
+    result[QStringLiteral("timeToFirstFrameMs")] = firstFrame / 1e6;
+    result[QStringLiteral("mpixelsPerSecond")] = perSecond(pixels, total) / 1e6;
+    result[QStringLiteral("iterationsPerSecond")] = perSecond(iterations, total);
+    result[QStringLiteral("computedPixels")] = computedPixels;
+    result[QStringLiteral("iterations")] = iterations;
+    result[QStringLiteral("passes")] = passes;
+    return result;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Renders a fixed set of Mandelbrot views and reports the timings as JSON"));
+    parser.addHelpOption();
+    QCommandLineOption threadsOption(QStringList() << QStringLiteral("t") << QStringLiteral("threads"),
+                                     QStringLiteral("Number of threads used for rendering."),
+                                     QStringLiteral("count"));
+    parser.addOption(threadsOption);
+    QCommandLineOption kernelOption(QStringList() << QStringLiteral("k") << QStringLiteral("kernel"),
+                                    QStringLiteral("Escape time kernel: scalar, avx2 or avx512."),
+                                    QStringLiteral("name"));
+    parser.addOption(kernelOption);
+    QCommandLineOption formulaOption(QStringList() << QStringLiteral("f") << QStringLiteral("formula"),
+                                     QStringLiteral("Fractal: mandelbrot, julia, burning-ship or multibrot3."),
+                                     QStringLiteral("name"));
+    parser.addOption(formulaOption);
+    QCommandLineOption sizeOption(QStringList() << QStringLiteral("s") << QStringLiteral("size"),
+                                  QStringLiteral("Image size, 640x480 by default."),
+                                  QStringLiteral("WxH"));
+    parser.addOption(sizeOption);
+    QCommandLineOption subdivideOption(QStringList() << QStringLiteral("subdivide"),
+                                       QStringLiteral("Subdivision mode: none, previews or all."),
+                                       QStringLiteral("passes"));
+    parser.addOption(subdivideOption);
+    QCommandLineOption previewOption(QStringList() << QStringLiteral("preview-budget"),
+                                     QStringLiteral("Time for a low resolution preview before the passes, off by default."),
+                                     QStringLiteral("ms"));
+    parser.addOption(previewOption);
+    QCommandLineOption viewOption(QStringList() << QStringLiteral("v") << QStringLiteral("view"),
+                                  QStringLiteral("Only render the named view, can be repeated."),
+                                  QStringLiteral("name"));
+    parser.addOption(viewOption);
+    QCommandLineOption outputOption(QStringList() << QStringLiteral("o") << QStringLiteral("output"),
+                                    QStringLiteral("Write the JSON report to a file instead of stdout."),
+                                    QStringLiteral("file"));
+    parser.addOption(outputOption);
+    parser.process(app);
+
+    Settings settings;
+    if(parser.isSet(threadsOption))
+    {
+        settings.threadCount = parser.value(threadsOption).toInt();
+    }
+    if(parser.isSet(kernelOption))
+    {
+        const QString kernel = parser.value(kernelOption);
+        for(auto instructionSet : {EscapeKernel::Scalar, EscapeKernel::Avx2, EscapeKernel::Avx512})
+        {
+            if(kernel == QLatin1String(EscapeKernel::name(instructionSet)))
+            {
+                settings.instructionSet = instructionSet;
+            }
+        }
+    }
+    if(parser.isSet(formulaOption))
+    {
+        const QString formula = parser.value(formulaOption);
+        for(auto candidate : {EscapeKernel::Mandelbrot, EscapeKernel::Julia, EscapeKernel::BurningShip,
+                              EscapeKernel::Multibrot3})
+        {
+            if(formula == QLatin1String(EscapeKernel::name(candidate)))
+            {
+                settings.formula = candidate;
+            }
+        }
+    }
+    if(parser.isSet(sizeOption))
+    {
+        const QStringList size = parser.value(sizeOption).split(QLatin1Char('x'));
+        if(size.size() == 2 && size.at(0).toInt() > 0 && size.at(1).toInt() > 0)
+        {
+            settings.size = QSize(size.at(0).toInt(), size.at(1).toInt());
+        }
+    }
+    if(parser.isSet(subdivideOption))
+    {
+        const QString passes = parser.value(subdivideOption);
+        settings.subdivision = passes == QLatin1String("previews") ? RenderThread::SubdividePreviews :
+                               passes == QLatin1String("all") ? RenderThread::SubdivideAllPasses :
+                                                                RenderThread::NoSubdivision;
+    }
+    if(parser.isSet(previewOption))
+    {
+        settings.previewBudget = parser.value(previewOption).toInt();
+    }
+    if(!EscapeKernel::isSupported(settings.instructionSet))
+    {
+        settings.instructionSet = EscapeKernel::bestInstructionSet();
+    }
+
+    const QStringList selected = parser.values(viewOption);
+    QJsonArray views;
+    for(const View& view : Views)
+    {
+        if(!selected.isEmpty() && !selected.contains(QLatin1String(view.name)))
+        {
+            continue;
+        }
+        views.append(runView(view, settings));
+    }
+
+    QJsonObject report;
+    report[QStringLiteral("kernel")] = QLatin1String(EscapeKernel::name(settings.instructionSet));
+    report[QStringLiteral("formula")] = QLatin1String(EscapeKernel::name(settings.formula));
+    report[QStringLiteral("threads")] = settings.threadCount > 0 ? settings.threadCount : QThread::idealThreadCount();
+    report[QStringLiteral("width")] = settings.size.width();
+    report[QStringLiteral("height")] = settings.size.height();
+    report[QStringLiteral("views")] = views;
+    const QByteArray json = QJsonDocument(report).toJson();
+
+    if(parser.isSet(outputOption))
+    {
+        QFile file(parser.value(outputOption));
+        if(!file.open(QIODevice::WriteOnly))
+        {
+            qWarning() << "Cannot write" << file.fileName();
+            return 1;
+        }
+        file.write(json);
+        return 0;
+    }
+
+    QFile standardOutput;
+    standardOutput.open(stdout, QIODevice::WriteOnly);
+    standardOutput.write(json);
+    return 0;
+}
@@ -0,0 +1,95 @@
+#ifndef DOUBLEDOUBLE_H
+#define DOUBLEDOUBLE_H
+
+//Unevaluated sum of two doubles with about 106 bits of mantissa, for views
+//too deep for double which are not rendered with perturbation. The error
+//free transformations need strict IEEE rounding, so the build keeps the
+//compiler from contracting them into fused multiply-adds.
+struct DoubleDouble
+{
+    double hi = 0;
+    double lo = 0;
+
+    DoubleDouble() = default;
+    DoubleDouble(double value) : hi(value) {}
+    DoubleDouble(double hi, double lo) : hi(hi), lo(lo) {}
+
+    explicit operator double() const { return hi; }
+
+    friend DoubleDouble operator-(const DoubleDouble& a) { return DoubleDouble(-a.hi, -a.lo); }
+
+    friend DoubleDouble operator+(const DoubleDouble& a, const DoubleDouble& b)
+    {
+        double error;
+        double sum = twoSum(a.hi, b.hi, &error);
+        double lowError;
+        const double lowSum = twoSum(a.lo, b.lo, &lowError);
+        error += lowSum;
+        sum = quickTwoSum(sum, error, &error);
+        error += lowError;
+        sum = quickTwoSum(sum, error, &error);
+        return DoubleDouble(sum, error);
+    }
+
+    friend DoubleDouble operator-(const DoubleDouble& a, const DoubleDouble& b) { return a + (-b); }
+
+    friend DoubleDouble operator*(const DoubleDouble& a, const DoubleDouble& b)
+    {
+        double error;
+        double product = twoProduct(a.hi, b.hi, &error);
+        error += (a.hi * b.lo) + (a.lo * b.hi);
+        product = quickTwoSum(product, error, &error);
+        return DoubleDouble(product, error);
+    }
+
+    friend DoubleDouble abs(const DoubleDouble& a) { return a.hi < 0 ? -a : a; }
+
+    friend bool operator==(const DoubleDouble& a, const DoubleDouble& b) { return a.hi == b.hi && a.lo == b.lo; }
+    friend bool operator<(const DoubleDouble& a, const DoubleDouble& b)
+    {
+        return a.hi < b.hi || (a.hi == b.hi && a.lo < b.lo);
+    }
+    friend bool operator>(const DoubleDouble& a, const DoubleDouble& b) { return b < a; }
+    friend bool operator<=(const DoubleDouble& a, const DoubleDouble& b) { return !(b < a); }
+
+private:
+    //a + b = sum + error exactly, for any order of magnitude
+    static double twoSum(double a, double b, double* error)
+    {
+        const double sum = a + b;
+        const double b1 = sum - a;
+        *error = (a - (sum - b1)) + (b - b1);
+        return sum;
+    }
+
+    //Same for |a| >= |b|
+    static double quickTwoSum(double a, double b, double* error)
+    {
+        const double sum = a + b;
+        *error = b - (sum - a);
+        return sum;
+    }
+
+    //Dekker product, a * b = product + error exactly
+    static double twoProduct(double a, double b, double* error)
+    {
+        const double product = a * b;
+        double aHigh;
+        double aLow;
+        double bHigh;
+        double bLow;
+        split(a, &aHigh, &aLow);
+        split(b, &bHigh, &bLow);
+        *error = (((aHigh * bHigh) - product) + (aHigh * bLow) + (aLow * bHigh)) + (aLow * bLow);
+        return product;
+    }
+
+    static void split(double a, double* high, double* low)
+    {
+        const double t = 134217729.0 * a;
+        *high = t - (t - a);
+        *low = a - *high;
+    }
+};
+
+#endif // DOUBLEDOUBLE_H
@@ -0,0 +1,397 @@
+#include "escapekernel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+namespace EscapeKernel
+{
+
+namespace
+{
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+bool osSavesZmmState()
+{
+    //XCR0 has to enable SSE, AVX and the three AVX-512 state components
+    return (_xgetbv(0) & 0xe6) == 0xe6;
+}
+
+bool osSavesYmmState()
+{
+    return (_xgetbv(0) & 0x6) == 0x6;
+}
+
+bool cpuHasAvx2()
+{
+    int info[4];
+    __cpuid(info, 1);
+    const bool osxsave = info[2] & (1 << 27);
+    if(!osxsave || !osSavesYmmState())
+    {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return info[1] & (1 << 5);
+}
+
+bool cpuHasAvx512()
+{
+    if(!cpuHasAvx2() || !osSavesZmmState())
+    {
+        return false;
+    }
+    int info[4];
+    __cpuidex(info, 7, 0);
+    return info[1] & (1 << 16);
+}
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+bool cpuHasAvx2()
+{
+    //Also checks that the operating system saves the extended registers
+    return __builtin_cpu_supports("avx2");
+}
+
+bool cpuHasAvx512()
+{
+    return __builtin_cpu_supports("avx512f");
+}
+#else
+bool cpuHasAvx2()
+{
+    return false;
+}
+
+bool cpuHasAvx512()
+{
+    return false;
+}
+#endif
+
+//Pixel positions are computed in double for the types which are not wider,
+//so the vectorized kernels can round them the same way
+template<typename Real>
+struct RealTraits
+{
+    typedef double Coordinate;
+    //Z fits into the doubles of RowState
+    enum {Resumable = true};
+};
+
+template<>
+struct RealTraits<DoubleDouble>
+{
+    typedef DoubleDouble Coordinate;
+    enum {Resumable = false};
+};
+
+//Scalar iteration of any formula in any of the precisions, see RowFunction
+template<typename Policy, typename Real>
+void escapeRow(typename RealTraits<Real>::Coordinate centerX, double scaleFactor, int firstColumn,
+               typename RealTraits<Real>::Coordinate ay, int count, int maxIterations, int interiorChecks,
+               int* iterations, float* magnitudes, const RowState* state, const Fractal& fractal)
+{
+    typedef typename RealTraits<Real>::Coordinate Coordinate;
+    const Real Limit = Real(4);
+    const Real y0 = Real(ay);
+    const Real cy = Policy::hasConstant ? Real(fractal.juliaY) : y0;
+    const int interior = stepLimit(maxIterations);
+
+    for(int k = 0; k < count; ++k)
+    {
+        int numIterations = state ? state->steps[k] : 0;
+        if(numIterations < 0)
+        {
+            //Finished in an earlier call, escape steps beyond this limit are cut to it
+            iterations[k] = numIterations == InteriorSteps ? interior : std::min(-1 - numIterations, interior);
+            if(magnitudes)
+            {
+                magnitudes[k] = float(state->x[k]);
+            }
+            continue;
+        }
+        if(numIterations > 0 && !RealTraits<Real>::Resumable)
+        {
+            //Only the high part of z was kept, so the orbit starts over
+            numIterations = 0;
+        }
+
+        const Real ax = Real(centerX + (Coordinate(firstColumn + k) * Coordinate(scaleFactor)));
+        const Real cx = Policy::hasConstant ? Real(fractal.juliaX) : ax;
+        if(Policy::hasCardioid && numIterations == 0 && (interiorChecks & CardioidCheck) &&
+                isInMainCardioidOrBulb(ax, y0))
+        {
+            iterations[k] = interior;
+            if(state)
+            {
+                state->steps[k] = InteriorSteps;
+            }
+            continue;
+        }
+
+        Real a1 = numIterations ? Real(state->x[k]) : ax;
+        Real b1 = numIterations ? Real(state->y[k]) : y0;
+        bool escaped = false;
+        bool periodic = false;
+        Real magnitude = Real(0);
+
+        if(interiorChecks & PeriodicityCheck)
+        {
+            //Orbit is compared with a saved point, which moves forward every
+            //time the step count of this call reaches a power of two
+            Real savedA = a1;
+            Real savedB = b1;
+            int steps = 0;
+            int nextSave = 1;
+
+            while (numIterations < interior)
+            {
+                ++numIterations;
+                ++steps;
+                Policy::step(a1, b1, cx, cy);
+                magnitude = (a1 * a1) + (b1 * b1);
+                if (magnitude > Limit)
+                {
+                    escaped = true;
+                    break;
+                }
+
+                if (a1 == savedA && b1 == savedB)
+                {
+                    periodic = true;
+                    break;
+                }
+
+                if (steps == nextSave)
+                {
+                    savedA = a1;
+                    savedB = b1;
+                    nextSave *= 2;
+                }
+            }
+        }
+        else
+        {
+            while (numIterations < interior)
+            {
+                //Two steps per test of the step limit
+                ++numIterations;
+                Real a2 = a1;
+                Real b2 = b1;
+                Policy::step(a2, b2, cx, cy);
+                magnitude = (a2 * a2) + (b2 * b2);
+                if (magnitude > Limit)
+                {
+                    escaped = true;
+                    break;
+                }
+
+                ++numIterations;
+                a1 = a2;
+                b1 = b2;
+                Policy::step(a1, b1, cx, cy);
+                magnitude = (a1 * a1) + (b1 * b1);
+                if (magnitude > Limit)
+                {
+                    escaped = true;
+                    break;
+                }
+            }
+        }
+
+        iterations[k] = periodic ? interior : std::min(numIterations, interior);
+        if(magnitudes)
+        {
+            magnitudes[k] = float(double(magnitude));
+        }
+        if(state)
+        {
+            state->steps[k] = escaped ? escapedSteps(numIterations) : periodic ? InteriorSteps : numIterations;
+            state->x[k] = double(escaped ? magnitude : a1);
+            state->y[k] = double(b1);
+        }
+    }
+}
+
+template<typename Policy>
+RowFunction scalarRowFunction(Precision precision)
+{
+    return precision == FloatPrecision ? scalarFloatRow<Policy> : scalarRow<Policy>;
+}
+
+}
+
+InstructionSet bestInstructionSet()
+{
+    static const InstructionSet best = cpuHasAvx512() ? Avx512 :
+                                       cpuHasAvx2() ? Avx2 : Scalar;
+    return best;
+}
+
+bool isSupported(InstructionSet instructionSet)
+{
+    switch(instructionSet)
+    {
+    case Avx512:
+        return bestInstructionSet() == Avx512;
+    case Avx2:
+        return bestInstructionSet() != Scalar;
+    case Scalar:
+        break;
+    }
+    return true;
+}
+
+RowFunction rowFunction(InstructionSet instructionSet, Precision precision, Formula formula)
+{
+    if(!isSupported(instructionSet))
+    {
+        instructionSet = bestInstructionSet();
+    }
+    if(instructionSet != Scalar)
+    {
+        return vectorRowFunction(instructionSet, precision, formula);
+    }
+
+    switch(formula)
+    {
+    case Julia:
+        return scalarRowFunction<JuliaPolicy>(precision);
+    case BurningShip:
+        return scalarRowFunction<BurningShipPolicy>(precision);
+    case Multibrot3:
+        return scalarRowFunction<Multibrot3Policy>(precision);
+    case Mandelbrot:
+        break;
+    }
+    return scalarRowFunction<MandelbrotPolicy>(precision);
+}
+
+const char* name(InstructionSet instructionSet)
+{
+    switch(instructionSet)
+    {
+    case Avx512:
+        return "avx512";
+    case Avx2:
+        return "avx2";
+    case Scalar:
+        break;
+    }
+    return "scalar";
+}
+
+const char* name(Formula formula)
+{
+    switch(formula)
+    {
+    case Julia:
+        return "julia";
+    case BurningShip:
+        return "burning-ship";
+    case Multibrot3:
+        return "multibrot3";
+    case Mandelbrot:
+        break;
+    }
+    return "mandelbrot";
+}
+
+Precision precisionFor(double centerX, double centerY, double scaleFactor, int width, int height,
+                       int maxIterations)
+{
+    //Pixels stay this many units in the last place apart, so the rounding
+    //of the first steps does not blur neighbouring pixels into each other
+    const double Margin = 1024;
+    //Largest coordinate of the view, orbits reach |z| = 2 before they escape
+    const double corner = std::max(std::abs(centerX), std::abs(centerY)) +
+            ((std::max(width, height) / 2 + 1) * scaleFactor);
+    const double unit = std::max(corner, 2.0) * Margin;
+    //Float has to give the counts of the double kernels, and its rounding
+    //error grows with every step, so the margin grows with the steps as well
+    if(scaleFactor >= unit * std::max(maxIterations, 1) * std::numeric_limits<float>::epsilon())
+    {
+        return FloatPrecision;
+    }
+    if(scaleFactor >= unit * std::numeric_limits<double>::epsilon())
+    {
+        return DoublePrecision;
+    }
+    return DoubleDoublePrecision;
+}
+
+const char* name(Precision precision)
+{
+    switch(precision)
+    {
+    case FloatPrecision:
+        return "float";
+    case DoubleDoublePrecision:
+        return "double-double";
+    case DoublePrecision:
+        break;
+    }
+    return "double";
+}
+
+template<typename Policy>
+void scalarRow(double centerX, double scaleFactor, int firstColumn, double ay,
+               int count, int maxIterations, int interiorChecks, int* iterations, float* magnitudes,
+               const RowState* state, const Fractal& fractal)
+{
+    escapeRow<Policy, double>(centerX, scaleFactor, firstColumn, ay, count, maxIterations, interiorChecks,
+                              iterations, magnitudes, state, fractal);
+}
+
+template<typename Policy>
+void scalarFloatRow(double centerX, double scaleFactor, int firstColumn, double ay,
+                    int count, int maxIterations, int interiorChecks, int* iterations, float* magnitudes,
+                    const RowState* state, const Fractal& fractal)
+{
+    escapeRow<Policy, float>(centerX, scaleFactor, firstColumn, ay, count, maxIterations, interiorChecks,
+                             iterations, magnitudes, state, fractal);
+}
+
+//The vectorized kernels finish their rows with these
+#define ESCAPEKERNEL_SCALAR_ROWS(Policy) \
+    template void scalarRow<Policy>(double, double, int, double, int, int, int, int*, float*, const RowState*, \
+                                    const Fractal&); \
+    template void scalarFloatRow<Policy>(double, double, int, double, int, int, int, int*, float*, \
+                                         const RowState*, const Fractal&);
+
+ESCAPEKERNEL_SCALAR_ROWS(MandelbrotPolicy)
+ESCAPEKERNEL_SCALAR_ROWS(JuliaPolicy)
+ESCAPEKERNEL_SCALAR_ROWS(BurningShipPolicy)
+ESCAPEKERNEL_SCALAR_ROWS(Multibrot3Policy)
+
+void doubleDoubleRow(const DoubleDouble& centerX, double scaleFactor, int firstColumn, const DoubleDouble& ay,
+                     int count, int maxIterations, int interiorChecks, int* iterations, float* magnitudes,
+                     const RowState* state, const Fractal& fractal)
+{
+    //Chosen once per row, the steps are inlined in each of the loops
+    switch(fractal.formula)
+    {
+    case Julia:
+        escapeRow<JuliaPolicy, DoubleDouble>(centerX, scaleFactor, firstColumn, ay, count, maxIterations,
+                                             interiorChecks, iterations, magnitudes, state, fractal);
+        return;
+    case BurningShip:
+        escapeRow<BurningShipPolicy, DoubleDouble>(centerX, scaleFactor, firstColumn, ay, count, maxIterations,
+                                                   interiorChecks, iterations, magnitudes, state, fractal);
+        return;
+    case Multibrot3:
+        escapeRow<Multibrot3Policy, DoubleDouble>(centerX, scaleFactor, firstColumn, ay, count, maxIterations,
+                                                  interiorChecks, iterations, magnitudes, state, fractal);
+        return;
+    case Mandelbrot:
+        break;
+    }
+    escapeRow<MandelbrotPolicy, DoubleDouble>(centerX, scaleFactor, firstColumn, ay, count, maxIterations,
+                                              interiorChecks, iterations, magnitudes, state, fractal);
+}
+}
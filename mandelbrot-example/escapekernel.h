@@ -0,0 +1,227 @@
+#ifndef ESCAPEKERNEL_H
+#define ESCAPEKERNEL_H
+
+#include "doubledouble.h"
+
+#include <cmath>
+
+namespace EscapeKernel
+{
+
+enum InstructionSet
+{
+    Scalar,
+    Avx2,
+    Avx512
+};
+
+//Numeric type of the iteration, each one resolves smaller pixels than the
+//one before at a higher cost. Float runs twice the lanes of double.
+enum Precision
+{
+    FloatPrecision,
+    DoublePrecision,
+    DoubleDoublePrecision
+};
+
+//Shortcuts for points inside the set, which would otherwise run all iterations
+enum InteriorCheck
+{
+    NoInteriorChecks = 0x0,
+    //Analytic test for the main cardioid and the period-2 bulb
+    CardioidCheck = 0x1,
+    //Brent cycle detection of the orbit, only exact repetitions are taken
+    //so the result is the same as without the check
+    PeriodicityCheck = 0x2
+};
+
+//Iteration formulas, each one has kernels of its own
+enum Formula
+{
+    //z -> z^2 + c
+    Mandelbrot,
+    //z -> z^2 + k, for a constant k and z starting at the pixel
+    Julia,
+    //z -> (|Re z| + i |Im z|)^2 + c
+    BurningShip,
+    //z -> z^3 + c
+    Multibrot3
+};
+
+//Formula of a view and its parameters
+struct Fractal
+{
+    Formula formula = Mandelbrot;
+    //Constant k of the Julia set
+    double juliaX = -0.8;
+    double juliaY = 0.156;
+};
+
+inline bool operator==(const Fractal& a, const Fractal& b)
+{
+    //Julia constants of the other formulas do not matter
+    return a.formula == b.formula && (a.formula != Julia || (a.juliaX == b.juliaX && a.juliaY == b.juliaY));
+}
+
+inline bool operator!=(const Fractal& a, const Fractal& b)
+{
+    return !(a == b);
+}
+
+//Steps of the formulas as compile time policies. The kernels are templates
+//on them, so each formula gets its own kernels with the step inlined into
+//the loop and no branch on the formula in it. Steps only take +, -, * and
+//abs in a fixed order, so they are written once for the scalars and the
+//vector types, and every kernel rounds the same way. Orbits start at z = c,
+//which is one step past z = 0, for the Julia set at the pixel.
+struct MandelbrotPolicy
+{
+    static const Formula formula = Mandelbrot;
+    //Cardioid and bulb of CardioidCheck are inside
+    static const bool hasCardioid = true;
+    //c is the Julia constant instead of the pixel
+    static const bool hasConstant = false;
+
+    template<typename Real>
+    static void step(Real& a, Real& b, const Real& cx, const Real& cy)
+    {
+        const Real a2 = (a * a) - (b * b) + cx;
+        b = ((a + a) * b) + cy;
+        a = a2;
+    }
+};
+
+struct JuliaPolicy : MandelbrotPolicy
+{
+    static const Formula formula = Julia;
+    static const bool hasCardioid = false;
+    static const bool hasConstant = true;
+};
+
+struct BurningShipPolicy
+{
+    static const Formula formula = BurningShip;
+    static const bool hasCardioid = false;
+    static const bool hasConstant = false;
+
+    template<typename Real>
+    static void step(Real& a, Real& b, const Real& cx, const Real& cy)
+    {
+        using std::abs;
+        const Real a2 = (a * a) - (b * b) + cx;
+        b = abs((a + a) * b) + cy;
+        a = a2;
+    }
+};
+
+struct Multibrot3Policy
+{
+    static const Formula formula = Multibrot3;
+    static const bool hasCardioid = false;
+    static const bool hasConstant = false;
+
+    template<typename Real>
+    static void step(Real& a, Real& b, const Real& cx, const Real& cy)
+    {
+        const Real aa = a * a;
+        const Real bb = b * b;
+        const Real a2 = (a * (aa - (bb + bb + bb))) + cx;
+        b = (b * ((aa + aa + aa) - bb)) + cy;
+        a = a2;
+    }
+};
+
+//Where the iteration of a run of pixels stopped, so a later call with more
+//iterations continues them instead of starting over. Pixels which still
+//iterate keep the number of steps done and z, finished ones a negative value.
+//Escaped pixels keep |z|^2 of their escape in x.
+struct RowState
+{
+    double* x;
+    double* y;
+    //Zero starts the pixel over
+    int* steps;
+};
+
+//Pixel found inside the set, its result is always the step limit
+const int InteriorSteps = -1;
+
+inline int escapedSteps(int iterations)
+{
+    return -1 - iterations;
+}
+
+//Computes the escape time of a run of pixels on one scanline. Pixel k of the
+//run is located at centerX + (firstColumn + k) * scaleFactor, ay. Points which
+//do not escape get stepLimit(maxIterations) as their result. Magnitudes are
+//optional and receive |z|^2 at the escape, the other pixels are left undefined.
+//State is optional, without it every pixel starts from zero. The formula is
+//the one of the kernel, only the parameters are taken from fractal.
+typedef void (*RowFunction)(double centerX, double scaleFactor, int firstColumn, double ay,
+                            int count, int maxIterations, int interiorChecks, int* iterations,
+                            float* magnitudes, const RowState* state, const Fractal& fractal);
+
+//The iteration runs in pairs and only tests the limit after the second
+//step, so for odd limits it does one step more
+inline int stepLimit(int maxIterations)
+{
+    return maxIterations < 2 ? 2 : maxIterations + (maxIterations & 1);
+}
+
+template<typename Real>
+inline bool isInMainCardioidOrBulb(Real x, Real y)
+{
+    const Real y2 = y * y;
+    const Real xq = x - Real(0.25);
+    const Real q = (xq * xq) + y2;
+    if ((q * (q + xq)) <= (Real(0.25) * y2))
+    {
+        return true;
+    }
+    const Real xb = x + Real(1.0);
+    return ((xb * xb) + y2) <= Real(0.0625);
+}
+
+//Best instruction set supported by the processor the program is running on
+InstructionSet bestInstructionSet();
+bool isSupported(InstructionSet instructionSet);
+//Float and double kernels, double-double has wider coordinates and is only
+//available as doubleDoubleRow(). It gets the double kernel here.
+RowFunction rowFunction(InstructionSet instructionSet, Precision precision = DoublePrecision,
+                        Formula formula = Mandelbrot);
+//Vectorized kernels of the instruction set, see rowFunction()
+RowFunction vectorRowFunction(InstructionSet instructionSet, Precision precision, Formula formula);
+const char* name(InstructionSet instructionSet);
+const char* name(Formula formula);
+
+//Cheapest precision which still resolves the pixels of a view of width x
+//height pixels of size scaleFactor, centered on (centerX, centerY), up to
+//maxIterations steps
+Precision precisionFor(double centerX, double centerY, double scaleFactor, int width, int height,
+                       int maxIterations);
+const char* name(Precision precision);
+
+//Scalar kernels of a formula policy, instantiated for all of the policies
+//above. The vectorized ones are only available through vectorRowFunction(),
+//their templates are compiled for their instruction sets.
+template<typename Policy>
+void scalarRow(double centerX, double scaleFactor, int firstColumn, double ay,
+               int count, int maxIterations, int interiorChecks, int* iterations, float* magnitudes,
+               const RowState* state, const Fractal& fractal);
+
+//Same kernel in single precision, pixel positions are computed in double
+//and rounded once. The state keeps z in doubles, which hold it exactly.
+template<typename Policy>
+void scalarFloatRow(double centerX, double scaleFactor, int firstColumn, double ay,
+                    int count, int maxIterations, int interiorChecks, int* iterations, float* magnitudes,
+                    const RowState* state, const Fractal& fractal);
+
+//Scalar only, of any formula. The state has no room for the low part of z,
+//so pixels which paused start over in the next call.
+void doubleDoubleRow(const DoubleDouble& centerX, double scaleFactor, int firstColumn, const DoubleDouble& ay,
+                     int count, int maxIterations, int interiorChecks, int* iterations, float* magnitudes,
+                     const RowState* state, const Fractal& fractal);
+
+}
+
+#endif // ESCAPEKERNEL_H
@@ -0,0 +1,765 @@
+#include "escapekernel.h"
+
+#include <algorithm>
+
+//The vectorized kernels are compiled with target attributes, so the rest of
+//the program stays runnable on processors without AVX. Which one is used is
+//decided at runtime, see EscapeKernel::rowFunction().
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define ESCAPEKERNEL_X86
+#include <immintrin.h>
+#endif
+
+#if defined(ESCAPEKERNEL_X86) && (defined(__GNUC__) || defined(__clang__))
+#define ESCAPEKERNEL_TARGET(features) __attribute__((target(features)))
+#else
+#define ESCAPEKERNEL_TARGET(features)
+#endif
+
+//The AVX-512 intrinsics pass _mm256_undefined_ps() and the like as operands
+//they do not read, and GCC reports the self initialized __Y of those as maybe
+//uninitialized. It is a known false positive of its headers, so the warning
+//is silenced around the AVX-512 kernels and nowhere else.
+#if defined(ESCAPEKERNEL_X86) && defined(__GNUC__) && !defined(__clang__)
+#define ESCAPEKERNEL_AVX512_BEGIN \
+    _Pragma("GCC diagnostic push") \
+    _Pragma("GCC diagnostic ignored \"-Wmaybe-uninitialized\"")
+#define ESCAPEKERNEL_AVX512_END _Pragma("GCC diagnostic pop")
+#else
+#define ESCAPEKERNEL_AVX512_BEGIN
+#define ESCAPEKERNEL_AVX512_END
+#endif
+
+namespace EscapeKernel
+{
+
+#ifdef ESCAPEKERNEL_X86
+
+namespace
+{
+//Vectors for the steps of the formula policies, which are written with
+//operators. Each operator is the one instruction it stands for.
+struct Avx2Doubles
+{
+    __m256d v;
+};
+
+struct Avx512Doubles
+{
+    __m512d v;
+};
+
+struct Avx2Floats
+{
+    __m256 v;
+};
+
+struct Avx512Floats
+{
+    __m512 v;
+};
+
+#if defined(__GNUC__) || defined(__clang__)
+//Vector extensions instead of intrinsics, the operators have no target of
+//their own and take the instruction set of the kernel they are inlined into
+typedef long long Avx2Bits __attribute__((vector_size(32)));
+typedef long long Avx512Bits __attribute__((vector_size(64)));
+typedef int Avx2FloatBits __attribute__((vector_size(32)));
+typedef int Avx512FloatBits __attribute__((vector_size(64)));
+
+#define ESCAPEKERNEL_OPERATORS(Vector, Bits, signBit) \
+    inline Vector operator+(const Vector& a, const Vector& b) { return Vector{a.v + b.v}; } \
+    inline Vector operator-(const Vector& a, const Vector& b) { return Vector{a.v - b.v}; } \
+    inline Vector operator*(const Vector& a, const Vector& b) { return Vector{a.v * b.v}; } \
+    inline Vector abs(const Vector& a) { return Vector{(decltype(a.v))((Bits)a.v & ~(Bits{} + signBit))}; }
+
+ESCAPEKERNEL_OPERATORS(Avx2Doubles, Avx2Bits, (1ll << 63))
+ESCAPEKERNEL_OPERATORS(Avx512Doubles, Avx512Bits, (1ll << 63))
+ESCAPEKERNEL_OPERATORS(Avx2Floats, Avx2FloatBits, (1 << 31))
+ESCAPEKERNEL_OPERATORS(Avx512Floats, Avx512FloatBits, (1 << 31))
+#else
+#define ESCAPEKERNEL_OPERATORS(Vector, add, sub, mul, absolute) \
+    inline Vector operator+(const Vector& a, const Vector& b) { return Vector{add(a.v, b.v)}; } \
+    inline Vector operator-(const Vector& a, const Vector& b) { return Vector{sub(a.v, b.v)}; } \
+    inline Vector operator*(const Vector& a, const Vector& b) { return Vector{mul(a.v, b.v)}; } \
+    inline Vector abs(const Vector& a) { return Vector{absolute}; }
+
+ESCAPEKERNEL_OPERATORS(Avx2Doubles, _mm256_add_pd, _mm256_sub_pd, _mm256_mul_pd,
+                       _mm256_andnot_pd(_mm256_set1_pd(-0.0), a.v))
+ESCAPEKERNEL_OPERATORS(Avx512Doubles, _mm512_add_pd, _mm512_sub_pd, _mm512_mul_pd, _mm512_abs_pd(a.v))
+ESCAPEKERNEL_OPERATORS(Avx2Floats, _mm256_add_ps, _mm256_sub_ps, _mm256_mul_ps,
+                       _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v))
+ESCAPEKERNEL_OPERATORS(Avx512Floats, _mm512_add_ps, _mm512_sub_ps, _mm512_mul_ps, _mm512_abs_ps(a.v))
+#endif
+
+#undef ESCAPEKERNEL_OPERATORS
+}
+
+//Every lane runs the same operations in the same order as scalarRow(), without
+//fused multiply-add, so both paths give bit identical iteration counts
+template<typename Policy>
+ESCAPEKERNEL_TARGET("avx2")
+void avx2Row(double centerX, double scaleFactor, int firstColumn, double ay,
+             int count, int maxIterations, int interiorChecks, int* iterations, float* magnitudes,
+             const RowState* state, const Fractal& fractal)
+{
+    const int Lanes = 4;
+    const int limit = stepLimit(maxIterations);
+    const __m256d vCenterX = _mm256_set1_pd(centerX);
+    const __m256d vScale = _mm256_set1_pd(scaleFactor);
+    const __m256d vAy = _mm256_set1_pd(ay);
+    const Avx2Doubles cy = {Policy::hasConstant ? _mm256_set1_pd(fractal.juliaY) : vAy};
+    const __m256d vOne = _mm256_set1_pd(1.0);
+    const __m256d vZero = _mm256_setzero_pd();
+    const __m256d vMinusOne = _mm256_set1_pd(-1.0);
+    const __m256d vInterior = _mm256_set1_pd(InteriorSteps);
+    const __m256d vLimit = _mm256_set1_pd(4.0);
+    const __m256d vSteps = _mm256_set1_pd(limit);
+    const __m128i laneOffsets = _mm_setr_epi32(0, 1, 2, 3);
+    const bool checkCardioid = Policy::hasCardioid && (interiorChecks & CardioidCheck);
+    const bool checkPeriodicity = interiorChecks & PeriodicityCheck;
+
+    int k = 0;
+    for(; k + Lanes <= count; k += Lanes)
+    {
+        const __m128i columns = _mm_add_epi32(_mm_set1_epi32(firstColumn + k), laneOffsets);
+        const __m256d ax = _mm256_add_pd(vCenterX, _mm256_mul_pd(_mm256_cvtepi32_pd(columns), vScale));
+        const Avx2Doubles cx = {Policy::hasConstant ? _mm256_set1_pd(fractal.juliaX) : ax};
+
+        //Lanes with steps in the state continue from the z stored there
+        int firstPause = limit;
+        __m256d step = vZero;
+        __m256d a = ax;
+        __m256d b = vAy;
+        if(state)
+        {
+            const __m128i steps = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state->steps + k));
+            step = _mm256_cvtepi32_pd(steps);
+            const __m256d fresh = _mm256_cmp_pd(step, vZero, _CMP_EQ_OQ);
+            a = _mm256_blendv_pd(_mm256_loadu_pd(state->x + k), ax, fresh);
+            b = _mm256_blendv_pd(_mm256_loadu_pd(state->y + k), vAy, fresh);
+            for(int lane = 0; lane < Lanes; ++lane)
+            {
+                firstPause = std::min(firstPause, limit - state->steps[k + lane]);
+            }
+        }
+
+        __m256d active = _mm256_and_pd(_mm256_cmp_pd(step, vZero, _CMP_GE_OQ), _mm256_cmp_pd(step, vSteps, _CMP_LT_OQ));
+        __m256d outSteps = step;
+        __m256d stoppedA = a;
+        __m256d stoppedB = b;
+        __m256d savedA = a;
+        __m256d savedB = b;
+        int nextSave = 1;
+
+        if(checkCardioid)
+        {
+            //Only lanes which start from zero are tested
+            const __m256d y2 = _mm256_mul_pd(vAy, vAy);
+            const __m256d xq = _mm256_sub_pd(ax, _mm256_set1_pd(0.25));
+            const __m256d q = _mm256_add_pd(_mm256_mul_pd(xq, xq), y2);
+            const __m256d inCardioid = _mm256_cmp_pd(_mm256_mul_pd(q, _mm256_add_pd(q, xq)),
+                                                     _mm256_mul_pd(_mm256_set1_pd(0.25), y2), _CMP_LE_OQ);
+            const __m256d xb = _mm256_add_pd(ax, vOne);
+            const __m256d inBulb = _mm256_cmp_pd(_mm256_add_pd(_mm256_mul_pd(xb, xb), y2),
+                                                 _mm256_set1_pd(0.0625), _CMP_LE_OQ);
+            const __m256d interior = _mm256_and_pd(_mm256_or_pd(inCardioid, inBulb),
+                                                   _mm256_cmp_pd(step, vZero, _CMP_EQ_OQ));
+            outSteps = _mm256_blendv_pd(outSteps, vInterior, interior);
+            active = _mm256_andnot_pd(interior, active);
+        }
+
+        for(int round = 1; _mm256_movemask_pd(active); ++round)
+        {
+            Avx2Doubles za = {a};
+            Avx2Doubles zb = {b};
+            Policy::step(za, zb, cx, cy);
+            a = za.v;
+            b = zb.v;
+            step = _mm256_add_pd(step, vOne);
+
+            const __m256d magnitude = _mm256_add_pd(_mm256_mul_pd(a, a), _mm256_mul_pd(b, b));
+            const __m256d escaped = _mm256_and_pd(_mm256_cmp_pd(magnitude, vLimit, _CMP_GT_OQ), active);
+            if(_mm256_movemask_pd(escaped))
+            {
+                //Record the step and |z|^2 at which the lanes escaped and mask them out
+                outSteps = _mm256_blendv_pd(outSteps, _mm256_sub_pd(vMinusOne, step), escaped);
+                stoppedA = _mm256_blendv_pd(stoppedA, magnitude, escaped);
+                active = _mm256_andnot_pd(escaped, active);
+            }
+
+            if(checkPeriodicity)
+            {
+                //Lanes back at the saved point are periodic, so they keep the step limit
+                const __m256d repeated = _mm256_and_pd(_mm256_and_pd(_mm256_cmp_pd(a, savedA, _CMP_EQ_OQ),
+                                                                     _mm256_cmp_pd(b, savedB, _CMP_EQ_OQ)), active);
+                outSteps = _mm256_blendv_pd(outSteps, vInterior, repeated);
+                active = _mm256_andnot_pd(repeated, active);
+                if(round == nextSave)
+                {
+                    savedA = a;
+                    savedB = b;
+                    nextSave *= 2;
+                }
+            }
+
+            if(round >= firstPause)
+            {
+                //Lanes at the step limit keep their z for the next call
+                const __m256d paused = _mm256_and_pd(_mm256_cmp_pd(step, vSteps, _CMP_GE_OQ), active);
+                outSteps = _mm256_blendv_pd(outSteps, step, paused);
+                stoppedA = _mm256_blendv_pd(stoppedA, a, paused);
+                stoppedB = _mm256_blendv_pd(stoppedB, b, paused);
+                active = _mm256_andnot_pd(paused, active);
+            }
+        }
+
+        //Escape steps beyond this limit are cut to it
+        const __m256d escapedLanes = _mm256_cmp_pd(outSteps, vInterior, _CMP_LT_OQ);
+        const __m256d result = _mm256_blendv_pd(vSteps, _mm256_min_pd(_mm256_sub_pd(vMinusOne, outSteps), vSteps),
+                                                escapedLanes);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(iterations + k), _mm256_cvttpd_epi32(result));
+        if(magnitudes)
+        {
+            //Lanes which escaped in an earlier call loaded theirs from the state
+            _mm_storeu_ps(magnitudes + k, _mm256_cvtpd_ps(stoppedA));
+        }
+        if(state)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(state->steps + k), _mm256_cvttpd_epi32(outSteps));
+            _mm256_storeu_pd(state->x + k, stoppedA);
+            _mm256_storeu_pd(state->y + k, stoppedB);
+        }
+    }
+
+    if(k < count)
+    {
+        const RowState tail = state ? RowState{state->x + k, state->y + k, state->steps + k} : RowState();
+        scalarRow<Policy>(centerX, scaleFactor, firstColumn + k, ay, count - k, maxIterations, interiorChecks,
+                          iterations + k, magnitudes ? magnitudes + k : nullptr, state ? &tail : nullptr, fractal);
+    }
+}
+
+ESCAPEKERNEL_AVX512_BEGIN
+template<typename Policy>
+ESCAPEKERNEL_TARGET("avx512f")
+void avx512Row(double centerX, double scaleFactor, int firstColumn, double ay,
+               int count, int maxIterations, int interiorChecks, int* iterations, float* magnitudes,
+               const RowState* state, const Fractal& fractal)
+{
+    const int Lanes = 8;
+    const int limit = stepLimit(maxIterations);
+    const __m512d vCenterX = _mm512_set1_pd(centerX);
+    const __m512d vScale = _mm512_set1_pd(scaleFactor);
+    const __m512d vAy = _mm512_set1_pd(ay);
+    const Avx512Doubles cy = {Policy::hasConstant ? _mm512_set1_pd(fractal.juliaY) : vAy};
+    const __m512d vOne = _mm512_set1_pd(1.0);
+    const __m512d vZero = _mm512_setzero_pd();
+    const __m512d vMinusOne = _mm512_set1_pd(-1.0);
+    const __m512d vInterior = _mm512_set1_pd(InteriorSteps);
+    const __m512d vLimit = _mm512_set1_pd(4.0);
+    const __m512d vSteps = _mm512_set1_pd(limit);
+    const __m256i laneOffsets = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const bool checkCardioid = Policy::hasCardioid && (interiorChecks & CardioidCheck);
+    const bool checkPeriodicity = interiorChecks & PeriodicityCheck;
+
+    int k = 0;
+    for(; k + Lanes <= count; k += Lanes)
+    {
+        const __m256i columns = _mm256_add_epi32(_mm256_set1_epi32(firstColumn + k), laneOffsets);
+        const __m512d ax = _mm512_add_pd(vCenterX, _mm512_mul_pd(_mm512_cvtepi32_pd(columns), vScale));
+        const Avx512Doubles cx = {Policy::hasConstant ? _mm512_set1_pd(fractal.juliaX) : ax};
+
+        int firstPause = limit;
+        __m512d step = vZero;
+        __m512d a = ax;
+        __m512d b = vAy;
+        if(state)
+        {
+            const __m256i steps = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(state->steps + k));
+            step = _mm512_cvtepi32_pd(steps);
+            const __mmask8 resumed = _mm512_cmp_pd_mask(step, vZero, _CMP_NEQ_OQ);
+            a = _mm512_mask_loadu_pd(ax, resumed, state->x + k);
+            b = _mm512_mask_loadu_pd(vAy, resumed, state->y + k);
+            for(int lane = 0; lane < Lanes; ++lane)
+            {
+                firstPause = std::min(firstPause, limit - state->steps[k + lane]);
+            }
+        }
+
+        __mmask8 active = _mm512_cmp_pd_mask(step, vZero, _CMP_GE_OQ) & _mm512_cmp_pd_mask(step, vSteps, _CMP_LT_OQ);
+        __m512d outSteps = step;
+        __m512d stoppedA = a;
+        __m512d stoppedB = b;
+        __m512d savedA = a;
+        __m512d savedB = b;
+        int nextSave = 1;
+
+        if(checkCardioid)
+        {
+            const __m512d y2 = _mm512_mul_pd(vAy, vAy);
+            const __m512d xq = _mm512_sub_pd(ax, _mm512_set1_pd(0.25));
+            const __m512d q = _mm512_add_pd(_mm512_mul_pd(xq, xq), y2);
+            const __mmask8 inCardioid = _mm512_cmp_pd_mask(_mm512_mul_pd(q, _mm512_add_pd(q, xq)),
+                                                           _mm512_mul_pd(_mm512_set1_pd(0.25), y2), _CMP_LE_OQ);
+            const __m512d xb = _mm512_add_pd(ax, vOne);
+            const __mmask8 inBulb = _mm512_cmp_pd_mask(_mm512_add_pd(_mm512_mul_pd(xb, xb), y2),
+                                                       _mm512_set1_pd(0.0625), _CMP_LE_OQ);
+            const __mmask8 interior = (inCardioid | inBulb) & _mm512_cmp_pd_mask(step, vZero, _CMP_EQ_OQ);
+            outSteps = _mm512_mask_blend_pd(interior, outSteps, vInterior);
+            active &= ~interior;
+        }
+
+        for(int round = 1; active; ++round)
+        {
+            Avx512Doubles za = {a};
+            Avx512Doubles zb = {b};
+            Policy::step(za, zb, cx, cy);
+            a = za.v;
+            b = zb.v;
+            step = _mm512_add_pd(step, vOne);
+
+            const __m512d magnitude = _mm512_add_pd(_mm512_mul_pd(a, a), _mm512_mul_pd(b, b));
+            const __mmask8 escaped = _mm512_mask_cmp_pd_mask(active, magnitude, vLimit, _CMP_GT_OQ);
+            if(escaped)
+            {
+                outSteps = _mm512_mask_blend_pd(escaped, outSteps, _mm512_sub_pd(vMinusOne, step));
+                stoppedA = _mm512_mask_blend_pd(escaped, stoppedA, magnitude);
+                active &= ~escaped;
+            }
+
+            if(checkPeriodicity)
+            {
+                const __mmask8 repeated = active & _mm512_cmp_pd_mask(a, savedA, _CMP_EQ_OQ) &
+                        _mm512_cmp_pd_mask(b, savedB, _CMP_EQ_OQ);
+                outSteps = _mm512_mask_blend_pd(repeated, outSteps, vInterior);
+                active &= ~repeated;
+                if(round == nextSave)
+                {
+                    savedA = a;
+                    savedB = b;
+                    nextSave *= 2;
+                }
+            }
+
+            if(round >= firstPause)
+            {
+                const __mmask8 paused = _mm512_mask_cmp_pd_mask(active, step, vSteps, _CMP_GE_OQ);
+                outSteps = _mm512_mask_blend_pd(paused, outSteps, step);
+                stoppedA = _mm512_mask_blend_pd(paused, stoppedA, a);
+                stoppedB = _mm512_mask_blend_pd(paused, stoppedB, b);
+                active &= ~paused;
+            }
+        }
+
+        const __mmask8 escapedLanes = _mm512_cmp_pd_mask(outSteps, vInterior, _CMP_LT_OQ);
+        const __m512d result = _mm512_mask_blend_pd(escapedLanes, vSteps,
+                                                    _mm512_min_pd(_mm512_sub_pd(vMinusOne, outSteps), vSteps));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(iterations + k), _mm512_cvttpd_epi32(result));
+        if(magnitudes)
+        {
+            _mm256_storeu_ps(magnitudes + k, _mm512_cvtpd_ps(stoppedA));
+        }
+        if(state)
+        {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(state->steps + k), _mm512_cvttpd_epi32(outSteps));
+            _mm512_storeu_pd(state->x + k, stoppedA);
+            _mm512_storeu_pd(state->y + k, stoppedB);
+        }
+    }
+
+    if(k < count)
+    {
+        const RowState tail = state ? RowState{state->x + k, state->y + k, state->steps + k} : RowState();
+        scalarRow<Policy>(centerX, scaleFactor, firstColumn + k, ay, count - k, maxIterations, interiorChecks,
+                          iterations + k, magnitudes ? magnitudes + k : nullptr, state ? &tail : nullptr, fractal);
+    }
+}
+ESCAPEKERNEL_AVX512_END
+
+namespace
+{
+//Eight doubles rounded into one float vector
+ESCAPEKERNEL_TARGET("avx2")
+inline __m256 toFloats(__m256d low, __m256d high)
+{
+    return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm256_cvtpd_ps(low)), _mm256_cvtpd_ps(high), 1);
+}
+
+//Sixteen doubles rounded into one float vector
+ESCAPEKERNEL_TARGET("avx512f")
+inline __m512 toFloats(__m512d low, __m512d high)
+{
+    return _mm512_castpd_ps(_mm512_insertf64x4(_mm512_castps_pd(_mm512_castps256_ps512(_mm512_cvtpd_ps(low))),
+                                               _mm256_castps_pd(_mm512_cvtpd_ps(high)), 1));
+}
+
+ESCAPEKERNEL_TARGET("avx512f")
+inline __m256 highHalf(__m512 value)
+{
+    return _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(value), 1));
+}
+}
+
+//Eight float lanes, steps are counted in integer lanes. Pixel positions are
+//computed in double and rounded once, like in scalarFloatRow().
+template<typename Policy>
+ESCAPEKERNEL_TARGET("avx2")
+void avx2FloatRow(double centerX, double scaleFactor, int firstColumn, double ay,
+                  int count, int maxIterations, int interiorChecks, int* iterations, float* magnitudes,
+                  const RowState* state, const Fractal& fractal)
+{
+    const int Lanes = 8;
+    const int limit = stepLimit(maxIterations);
+    const __m256d vCenterX = _mm256_set1_pd(centerX);
+    const __m256d vScale = _mm256_set1_pd(scaleFactor);
+    const __m256 vAy = _mm256_set1_ps(float(ay));
+    const Avx2Floats cy = {Policy::hasConstant ? _mm256_set1_ps(float(fractal.juliaY)) : vAy};
+    const __m256 vLimit = _mm256_set1_ps(4.0f);
+    const __m256i vZero = _mm256_setzero_si256();
+    const __m256i vOne = _mm256_set1_epi32(1);
+    const __m256i vMinusOne = _mm256_set1_epi32(-1);
+    const __m256i vInterior = _mm256_set1_epi32(InteriorSteps);
+    const __m256i vSteps = _mm256_set1_epi32(limit);
+    const __m128i laneOffsets = _mm_setr_epi32(0, 1, 2, 3);
+    const __m128i halfOffset = _mm_set1_epi32(4);
+    const bool checkCardioid = Policy::hasCardioid && (interiorChecks & CardioidCheck);
+    const bool checkPeriodicity = interiorChecks & PeriodicityCheck;
+
+    int k = 0;
+    for(; k + Lanes <= count; k += Lanes)
+    {
+        const __m128i columns = _mm_add_epi32(_mm_set1_epi32(firstColumn + k), laneOffsets);
+        const __m256 ax = toFloats(_mm256_add_pd(vCenterX, _mm256_mul_pd(_mm256_cvtepi32_pd(columns), vScale)),
+                                   _mm256_add_pd(vCenterX, _mm256_mul_pd(_mm256_cvtepi32_pd(
+                                                     _mm_add_epi32(columns, halfOffset)), vScale)));
+        const Avx2Floats cx = {Policy::hasConstant ? _mm256_set1_ps(float(fractal.juliaX)) : ax};
+
+        int firstPause = limit;
+        __m256i step = vZero;
+        __m256 a = ax;
+        __m256 b = vAy;
+        if(state)
+        {
+            step = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(state->steps + k));
+            const __m256 fresh = _mm256_castsi256_ps(_mm256_cmpeq_epi32(step, vZero));
+            a = _mm256_blendv_ps(toFloats(_mm256_loadu_pd(state->x + k), _mm256_loadu_pd(state->x + k + 4)), ax, fresh);
+            b = _mm256_blendv_ps(toFloats(_mm256_loadu_pd(state->y + k), _mm256_loadu_pd(state->y + k + 4)), vAy, fresh);
+            for(int lane = 0; lane < Lanes; ++lane)
+            {
+                firstPause = std::min(firstPause, limit - state->steps[k + lane]);
+            }
+        }
+
+        __m256i active = _mm256_andnot_si256(_mm256_cmpgt_epi32(vZero, step), _mm256_cmpgt_epi32(vSteps, step));
+        __m256i outSteps = step;
+        __m256 stoppedA = a;
+        __m256 stoppedB = b;
+        __m256 savedA = a;
+        __m256 savedB = b;
+        int nextSave = 1;
+
+        if(checkCardioid)
+        {
+            const __m256 y2 = _mm256_mul_ps(vAy, vAy);
+            const __m256 xq = _mm256_sub_ps(ax, _mm256_set1_ps(0.25f));
+            const __m256 q = _mm256_add_ps(_mm256_mul_ps(xq, xq), y2);
+            const __m256 inCardioid = _mm256_cmp_ps(_mm256_mul_ps(q, _mm256_add_ps(q, xq)),
+                                                    _mm256_mul_ps(_mm256_set1_ps(0.25f), y2), _CMP_LE_OQ);
+            const __m256 xb = _mm256_add_ps(ax, _mm256_set1_ps(1.0f));
+            const __m256 inBulb = _mm256_cmp_ps(_mm256_add_ps(_mm256_mul_ps(xb, xb), y2),
+                                                _mm256_set1_ps(0.0625f), _CMP_LE_OQ);
+            const __m256i interior = _mm256_and_si256(_mm256_castps_si256(_mm256_or_ps(inCardioid, inBulb)),
+                                                      _mm256_cmpeq_epi32(step, vZero));
+            outSteps = _mm256_blendv_epi8(outSteps, vInterior, interior);
+            active = _mm256_andnot_si256(interior, active);
+        }
+
+        for(int round = 1; !_mm256_testz_si256(active, active); ++round)
+        {
+            Avx2Floats za = {a};
+            Avx2Floats zb = {b};
+            Policy::step(za, zb, cx, cy);
+            a = za.v;
+            b = zb.v;
+            step = _mm256_add_epi32(step, vOne);
+
+            const __m256 magnitude = _mm256_add_ps(_mm256_mul_ps(a, a), _mm256_mul_ps(b, b));
+            const __m256i escaped = _mm256_and_si256(_mm256_castps_si256(_mm256_cmp_ps(magnitude, vLimit, _CMP_GT_OQ)),
+                                                     active);
+            if(!_mm256_testz_si256(escaped, escaped))
+            {
+                outSteps = _mm256_blendv_epi8(outSteps, _mm256_sub_epi32(vMinusOne, step), escaped);
+                stoppedA = _mm256_blendv_ps(stoppedA, magnitude, _mm256_castsi256_ps(escaped));
+                active = _mm256_andnot_si256(escaped, active);
+            }
+
+            if(checkPeriodicity)
+            {
+                const __m256i repeated = _mm256_and_si256(_mm256_castps_si256(_mm256_and_ps(
+                                                              _mm256_cmp_ps(a, savedA, _CMP_EQ_OQ),
+                                                              _mm256_cmp_ps(b, savedB, _CMP_EQ_OQ))), active);
+                outSteps = _mm256_blendv_epi8(outSteps, vInterior, repeated);
+                active = _mm256_andnot_si256(repeated, active);
+                if(round == nextSave)
+                {
+                    savedA = a;
+                    savedB = b;
+                    nextSave *= 2;
+                }
+            }
+
+            if(round >= firstPause)
+            {
+                const __m256i paused = _mm256_andnot_si256(_mm256_cmpgt_epi32(vSteps, step), active);
+                outSteps = _mm256_blendv_epi8(outSteps, step, paused);
+                stoppedA = _mm256_blendv_ps(stoppedA, a, _mm256_castsi256_ps(paused));
+                stoppedB = _mm256_blendv_ps(stoppedB, b, _mm256_castsi256_ps(paused));
+                active = _mm256_andnot_si256(paused, active);
+            }
+        }
+
+        const __m256i escapedLanes = _mm256_cmpgt_epi32(vInterior, outSteps);
+        const __m256i result = _mm256_blendv_epi8(vSteps, _mm256_min_epi32(_mm256_sub_epi32(vMinusOne, outSteps),
+                                                                           vSteps), escapedLanes);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(iterations + k), result);
+        if(magnitudes)
+        {
+            _mm256_storeu_ps(magnitudes + k, stoppedA);
+        }
+        if(state)
+        {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(state->steps + k), outSteps);
+            _mm256_storeu_pd(state->x + k, _mm256_cvtps_pd(_mm256_castps256_ps128(stoppedA)));
+            _mm256_storeu_pd(state->x + k + 4, _mm256_cvtps_pd(_mm256_extractf128_ps(stoppedA, 1)));
+            _mm256_storeu_pd(state->y + k, _mm256_cvtps_pd(_mm256_castps256_ps128(stoppedB)));
+            _mm256_storeu_pd(state->y + k + 4, _mm256_cvtps_pd(_mm256_extractf128_ps(stoppedB, 1)));
+        }
+    }
+
+    if(k < count)
+    {
+        const RowState tail = state ? RowState{state->x + k, state->y + k, state->steps + k} : RowState();
+        scalarFloatRow<Policy>(centerX, scaleFactor, firstColumn + k, ay, count - k, maxIterations, interiorChecks,
+                               iterations + k, magnitudes ? magnitudes + k : nullptr, state ? &tail : nullptr,
+                               fractal);
+    }
+}
+
+ESCAPEKERNEL_AVX512_BEGIN
+template<typename Policy>
+ESCAPEKERNEL_TARGET("avx512f")
+void avx512FloatRow(double centerX, double scaleFactor, int firstColumn, double ay,
+                    int count, int maxIterations, int interiorChecks, int* iterations, float* magnitudes,
+                    const RowState* state, const Fractal& fractal)
+{
+    const int Lanes = 16;
+    const int limit = stepLimit(maxIterations);
+    const __m512d vCenterX = _mm512_set1_pd(centerX);
+    const __m512d vScale = _mm512_set1_pd(scaleFactor);
+    const __m512 vAy = _mm512_set1_ps(float(ay));
+    const Avx512Floats cy = {Policy::hasConstant ? _mm512_set1_ps(float(fractal.juliaY)) : vAy};
+    const __m512 vLimit = _mm512_set1_ps(4.0f);
+    const __m512i vZero = _mm512_setzero_si512();
+    const __m512i vOne = _mm512_set1_epi32(1);
+    const __m512i vMinusOne = _mm512_set1_epi32(-1);
+    const __m512i vInterior = _mm512_set1_epi32(InteriorSteps);
+    const __m512i vSteps = _mm512_set1_epi32(limit);
+    const __m256i laneOffsets = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i halfOffset = _mm256_set1_epi32(8);
+    const bool checkCardioid = Policy::hasCardioid && (interiorChecks & CardioidCheck);
+    const bool checkPeriodicity = interiorChecks & PeriodicityCheck;
+
+    int k = 0;
+    for(; k + Lanes <= count; k += Lanes)
+    {
+        const __m256i columns = _mm256_add_epi32(_mm256_set1_epi32(firstColumn + k), laneOffsets);
+        const __m512 ax = toFloats(_mm512_add_pd(vCenterX, _mm512_mul_pd(_mm512_cvtepi32_pd(columns), vScale)),
+                                   _mm512_add_pd(vCenterX, _mm512_mul_pd(_mm512_cvtepi32_pd(
+                                                     _mm256_add_epi32(columns, halfOffset)), vScale)));
+        const Avx512Floats cx = {Policy::hasConstant ? _mm512_set1_ps(float(fractal.juliaX)) : ax};
+
+        int firstPause = limit;
+        __m512i step = vZero;
+        __m512 a = ax;
+        __m512 b = vAy;
+        if(state)
+        {
+            step = _mm512_loadu_si512(state->steps + k);
+            const __mmask16 resumed = _mm512_cmpneq_epi32_mask(step, vZero);
+            a = _mm512_mask_blend_ps(resumed, ax, toFloats(_mm512_loadu_pd(state->x + k),
+                                                           _mm512_loadu_pd(state->x + k + 8)));
+            b = _mm512_mask_blend_ps(resumed, vAy, toFloats(_mm512_loadu_pd(state->y + k),
+                                                            _mm512_loadu_pd(state->y + k + 8)));
+            for(int lane = 0; lane < Lanes; ++lane)
+            {
+                firstPause = std::min(firstPause, limit - state->steps[k + lane]);
+            }
+        }
+
+        __mmask16 active = _mm512_cmpge_epi32_mask(step, vZero) & _mm512_cmplt_epi32_mask(step, vSteps);
+        __m512i outSteps = step;
+        __m512 stoppedA = a;
+        __m512 stoppedB = b;
+        __m512 savedA = a;
+        __m512 savedB = b;
+        int nextSave = 1;
+
+        if(checkCardioid)
+        {
+            const __m512 y2 = _mm512_mul_ps(vAy, vAy);
+            const __m512 xq = _mm512_sub_ps(ax, _mm512_set1_ps(0.25f));
+            const __m512 q = _mm512_add_ps(_mm512_mul_ps(xq, xq), y2);
+            const __mmask16 inCardioid = _mm512_cmp_ps_mask(_mm512_mul_ps(q, _mm512_add_ps(q, xq)),
+                                                            _mm512_mul_ps(_mm512_set1_ps(0.25f), y2), _CMP_LE_OQ);
+            const __m512 xb = _mm512_add_ps(ax, _mm512_set1_ps(1.0f));
+            const __mmask16 inBulb = _mm512_cmp_ps_mask(_mm512_add_ps(_mm512_mul_ps(xb, xb), y2),
+                                                        _mm512_set1_ps(0.0625f), _CMP_LE_OQ);
+            const __mmask16 interior = (inCardioid | inBulb) & _mm512_cmpeq_epi32_mask(step, vZero);
+            outSteps = _mm512_mask_blend_epi32(interior, outSteps, vInterior);
+            active &= ~interior;
+        }
+
+        for(int round = 1; active; ++round)
+        {
+            Avx512Floats za = {a};
+            Avx512Floats zb = {b};
+            Policy::step(za, zb, cx, cy);
+            a = za.v;
+            b = zb.v;
+            step = _mm512_add_epi32(step, vOne);
+
+            const __m512 magnitude = _mm512_add_ps(_mm512_mul_ps(a, a), _mm512_mul_ps(b, b));
+            const __mmask16 escaped = _mm512_mask_cmp_ps_mask(active, magnitude, vLimit, _CMP_GT_OQ);
+            if(escaped)
+            {
+                outSteps = _mm512_mask_blend_epi32(escaped, outSteps, _mm512_sub_epi32(vMinusOne, step));
+                stoppedA = _mm512_mask_blend_ps(escaped, stoppedA, magnitude);
+                active &= ~escaped;
+            }
+
+            if(checkPeriodicity)
+            {
+                const __mmask16 repeated = active & _mm512_cmp_ps_mask(a, savedA, _CMP_EQ_OQ) &
+                        _mm512_cmp_ps_mask(b, savedB, _CMP_EQ_OQ);
+                outSteps = _mm512_mask_blend_epi32(repeated, outSteps, vInterior);
+                active &= ~repeated;
+                if(round == nextSave)
+                {
+                    savedA = a;
+                    savedB = b;
+                    nextSave *= 2;
+                }
+            }
+
+            if(round >= firstPause)
+            {
+                const __mmask16 paused = _mm512_mask_cmpge_epi32_mask(active, step, vSteps);
+                outSteps = _mm512_mask_blend_epi32(paused, outSteps, step);
+                stoppedA = _mm512_mask_blend_ps(paused, stoppedA, a);
+                stoppedB = _mm512_mask_blend_ps(paused, stoppedB, b);
+                active &= ~paused;
+            }
+        }
+
+        const __mmask16 escapedLanes = _mm512_cmplt_epi32_mask(outSteps, vInterior);
+        const __m512i result = _mm512_mask_blend_epi32(escapedLanes, vSteps,
+                                                       _mm512_min_epi32(_mm512_sub_epi32(vMinusOne, outSteps), vSteps));
+        _mm512_storeu_si512(iterations + k, result);
+        if(magnitudes)
+        {
+            _mm512_storeu_ps(magnitudes + k, stoppedA);
+        }
+        if(state)
+        {
+            _mm512_storeu_si512(state->steps + k, outSteps);
+            _mm512_storeu_pd(state->x + k, _mm512_cvtps_pd(_mm512_castps512_ps256(stoppedA)));
+            _mm512_storeu_pd(state->x + k + 8, _mm512_cvtps_pd(highHalf(stoppedA)));
+            _mm512_storeu_pd(state->y + k, _mm512_cvtps_pd(_mm512_castps512_ps256(stoppedB)));
+            _mm512_storeu_pd(state->y + k + 8, _mm512_cvtps_pd(highHalf(stoppedB)));
+        }
+    }
+
+    if(k < count)
+    {
+        const RowState tail = state ? RowState{state->x + k, state->y + k, state->steps + k} : RowState();
+        scalarFloatRow<Policy>(centerX, scaleFactor, firstColumn + k, ay, count - k, maxIterations, interiorChecks,
+                               iterations + k, magnitudes ? magnitudes + k : nullptr, state ? &tail : nullptr,
+                               fractal);
+    }
+}
+ESCAPEKERNEL_AVX512_END
+
+#else
+
+template<typename Policy>
+void avx2Row(double centerX, double scaleFactor, int firstColumn, double ay,
+             int count, int maxIterations, int interiorChecks, int* iterations, float* magnitudes,
+             const RowState* state, const Fractal& fractal)
+{
+    scalarRow<Policy>(centerX, scaleFactor, firstColumn, ay, count, maxIterations, interiorChecks, iterations,
+                      magnitudes, state, fractal);
+}
+
+template<typename Policy>
+void avx512Row(double centerX, double scaleFactor, int firstColumn, double ay,
+               int count, int maxIterations, int interiorChecks, int* iterations, float* magnitudes,
+               const RowState* state, const Fractal& fractal)
+{
+    scalarRow<Policy>(centerX, scaleFactor, firstColumn, ay, count, maxIterations, interiorChecks, iterations,
+                      magnitudes, state, fractal);
+}
+
+template<typename Policy>
+void avx2FloatRow(double centerX, double scaleFactor, int firstColumn, double ay,
+                  int count, int maxIterations, int interiorChecks, int* iterations, float* magnitudes,
+                  const RowState* state, const Fractal& fractal)
+{
+    scalarFloatRow<Policy>(centerX, scaleFactor, firstColumn, ay, count, maxIterations, interiorChecks,
+                           iterations, magnitudes, state, fractal);
+}
+
+template<typename Policy>
+void avx512FloatRow(double centerX, double scaleFactor, int firstColumn, double ay,
+                    int count, int maxIterations, int interiorChecks, int* iterations, float* magnitudes,
+                    const RowState* state, const Fractal& fractal)
+{
+    scalarFloatRow<Policy>(centerX, scaleFactor, firstColumn, ay, count, maxIterations, interiorChecks,
+                           iterations, magnitudes, state, fractal);
+}
+
+#endif
+
+namespace
+{
+template<typename Policy>
+RowFunction policyRowFunction(InstructionSet instructionSet, Precision precision)
+{
+    const bool single = precision == FloatPrecision;
+    if(instructionSet == Avx512)
+    {
+        return single ? avx512FloatRow<Policy> : avx512Row<Policy>;
+    }
+    return single ? avx2FloatRow<Policy> : avx2Row<Policy>;
+}
+}
+
+//Instantiates the kernels of every formula for every instruction set, the
+//scalar ones are instantiated next to their template
+RowFunction vectorRowFunction(InstructionSet instructionSet, Precision precision, Formula formula)
+{
+    switch(formula)
+    {
+    case Julia:
+        return policyRowFunction<JuliaPolicy>(instructionSet, precision);
+    case BurningShip:
+        return policyRowFunction<BurningShipPolicy>(instructionSet, precision);
+    case Multibrot3:
+        return policyRowFunction<Multibrot3Policy>(instructionSet, precision);
+    case Mandelbrot:
+        break;
+    }
+    return policyRowFunction<MandelbrotPolicy>(instructionSet, precision);
+}
+
+}
@@ -0,0 +1,284 @@
+#include "fixedpoint.h"
+
+#include <QDataStream>
+#include <cmath>
+
+namespace
+{
+const int MinimumFractionLimbs = 2;
+//Enough to hold the lowest bit of any double exactly
+const int MaximumFractionLimbs = 36;
+//Bits kept beyond the requested resolution, so rounding errors of the
+//reference orbit stay far below one pixel
+const int GuardBits = 64;
+}
+
+FixedPoint::FixedPoint() :
+    limbs(MinimumFractionLimbs + IntegerLimbs, 0),
+    fraction(MinimumFractionLimbs),
+    negative(false)
+{
+}
+
+FixedPoint::FixedPoint(double value) : FixedPoint()
+{
+    if(value == 0 || !std::isfinite(value))
+    {
+        return;
+    }
+
+    int exponent;
+    std::frexp(value, &exponent);
+    const int lowestBit = exponent - 53;
+    const int needed = lowestBit < 0 ? (31 - lowestBit) / 32 : 0;
+    *this = FixedPoint(value, qBound(int(MinimumFractionLimbs), needed, int(MaximumFractionLimbs)));
+}
+
+FixedPoint::FixedPoint(double value, int fractionLimbs) :
+    limbs(fractionLimbs + IntegerLimbs, 0),
+    fraction(fractionLimbs),
+    negative(value < 0)
+{
+    if(value == 0 || !std::isfinite(value))
+    {
+        negative = false;
+        return;
+    }
+
+    int exponent;
+    const double mantissa = std::frexp(std::fabs(value), &exponent);
+    const quint64 bits = quint64(std::ldexp(mantissa, 53));
+
+    //Bit position of the lowest mantissa bit, counted from the lowest limb.
+    //Bits below the lowest limb are truncated, above the integer part dropped.
+    const int shift = exponent - 53 + 32 * fraction;
+    const int totalBits = 32 * limbs.size();
+    for(int bit = 0; bit < 53; ++bit)
+    {
+        const int position = shift + bit;
+        if((bits >> bit) & 1 && position >= 0 && position < totalBits)
+        {
+            limbs[position / 32] |= quint32(1) << (position % 32);
+        }
+    }
+    normalizeSign();
+}
+
+int FixedPoint::fractionLimbs() const
+{
+    return fraction;
+}
+
+FixedPoint FixedPoint::withFractionLimbs(int fractionLimbs) const
+{
+    FixedPoint result;
+    result.limbs.fill(0, fractionLimbs + IntegerLimbs);
+    result.fraction = fractionLimbs;
+    result.negative = negative;
+
+    const int offset = fractionLimbs - fraction;
+    for(int i = qMax(0, -offset); i < limbs.size(); ++i)
+    {
+        result.limbs[i + offset] = limbs.at(i);
+    }
+    result.normalizeSign();
+    return result;
+}
+
+double FixedPoint::toDouble() const
+{
+    //Three limbs from the highest non zero one cover the double mantissa
+    double result = 0;
+    int used = 0;
+    for(int i = limbs.size() - 1; i >= 0 && used < 3; --i)
+    {
+        if(limbs.at(i) != 0 || used > 0)
+        {
+            result += std::ldexp(double(limbs.at(i)), 32 * (i - fraction));
+            ++used;
+        }
+    }
+    return negative ? -result : result;
+}
+
+DoubleDouble FixedPoint::toDoubleDouble() const
+{
+    //High part is exact in fixed point, so the rest of the value is as well
+    const double high = toDouble();
+    return DoubleDouble(high, (*this - FixedPoint(high)).toDouble());
+}
+
+bool FixedPoint::isNegative() const
+{
+    return negative;
+}
+
+bool FixedPoint::isZero() const
+{
+    for(quint32 limb : limbs)
+    {
+        if(limb != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+FixedPoint FixedPoint::operator-() const
+{
+    FixedPoint result(*this);
+    result.negative = !negative;
+    result.normalizeSign();
+    return result;
+}
+
+FixedPoint &FixedPoint::operator+=(const FixedPoint &other)
+{
+    if(other.fraction > fraction)
+    {
+        *this = withFractionLimbs(other.fraction);
+    }
+    const FixedPoint aligned = other.fraction == fraction ? other : other.withFractionLimbs(fraction);
+
+    if(negative == aligned.negative)
+    {
+        addMagnitude(aligned);
+    }
+    else if(compareMagnitude(aligned) >= 0)
+    {
+        subtractMagnitude(aligned);
+    }
+    else
+    {
+        FixedPoint result(aligned);
+        result.subtractMagnitude(*this);
+        *this = result;
+    }
+    normalizeSign();
+    return *this;
+}
+
+FixedPoint &FixedPoint::operator-=(const FixedPoint &other)
+{
+    return *this += -other;
+}
+
+FixedPoint operator*(const FixedPoint &a, const FixedPoint &b)
+{
+    //Schoolbook multiplication of the magnitudes, the product has the
+    //fraction limbs of both operands
+    const int n = a.limbs.size();
+    const int m = b.limbs.size();
+    QVector<quint32> product(n + m, 0);
+    for(int i = 0; i < n; ++i)
+    {
+        const quint64 ai = a.limbs.at(i);
+        if(ai == 0)
+        {
+            continue;
+        }
+
+        quint64 carry = 0;
+        for(int j = 0; j < m; ++j)
+        {
+            const quint64 t = ai * b.limbs.at(j) + product.at(i + j) + carry;
+            product[i + j] = quint32(t);
+            carry = t >> 32;
+        }
+        product[i + m] = quint32(carry);
+    }
+
+    FixedPoint result;
+    result.fraction = qMax(a.fraction, b.fraction);
+    result.limbs.fill(0, result.fraction + FixedPoint::IntegerLimbs);
+    const int dropped = a.fraction + b.fraction - result.fraction;
+    for(int i = 0; i < result.limbs.size(); ++i)
+    {
+        result.limbs[i] = product.at(i + dropped);
+    }
+    result.negative = a.negative != b.negative;
+    result.normalizeSign();
+    return result;
+}
+
+int FixedPoint::fractionLimbsFor(double resolution)
+{
+    if(!(resolution > 0) || resolution >= 1)
+    {
+        return MinimumFractionLimbs;
+    }
+    const int bits = int(std::ceil(-std::log2(resolution))) + GuardBits;
+    return qBound(int(MinimumFractionLimbs), (bits + 31) / 32, int(MaximumFractionLimbs));
+}
+
+void FixedPoint::addMagnitude(const FixedPoint &other)
+{
+    quint64 carry = 0;
+    for(int i = 0; i < limbs.size(); ++i)
+    {
+        const quint64 sum = quint64(limbs.at(i)) + other.limbs.at(i) + carry;
+        limbs[i] = quint32(sum);
+        carry = sum >> 32;
+    }
+}
+
+void FixedPoint::subtractMagnitude(const FixedPoint &other)
+{
+    qint64 borrow = 0;
+    for(int i = 0; i < limbs.size(); ++i)
+    {
+        qint64 difference = qint64(limbs.at(i)) - other.limbs.at(i) - borrow;
+        borrow = difference < 0 ? 1 : 0;
+        if(borrow)
+        {
+            difference += qint64(1) << 32;
+        }
+        limbs[i] = quint32(difference);
+    }
+}
+
+int FixedPoint::compareMagnitude(const FixedPoint &other) const
+{
+    for(int i = limbs.size() - 1; i >= 0; --i)
+    {
+        if(limbs.at(i) != other.limbs.at(i))
+        {
+            return limbs.at(i) < other.limbs.at(i) ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+QDataStream& operator<<(QDataStream& stream, const FixedPoint& value)
+{
+    return stream << value.limbs << qint32(value.fraction) << value.negative;
+}
+
+QDataStream& operator>>(QDataStream& stream, FixedPoint& value)
+{
+    QVector<quint32> limbs;
+    qint32 fraction = 0;
+    bool negative = false;
+    stream >> limbs >> fraction >> negative;
+    //Malformed values leave the number unchanged
+    if(fraction < 0 || limbs.size() != fraction + FixedPoint::IntegerLimbs)
+    {
+        stream.setStatus(QDataStream::ReadCorruptData);
+        return stream;
+    }
+
+    value.limbs = limbs;
+    value.fraction = fraction;
+    value.negative = negative;
+    value.normalizeSign();
+    return stream;
+}
+
+void FixedPoint::normalizeSign()
+{
+    if(negative && isZero())
+    {
+        negative = false;
+    }
+}
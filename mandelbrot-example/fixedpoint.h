@@ -0,0 +1,62 @@
+#ifndef FIXEDPOINT_H
+#define FIXEDPOINT_H
+
+#include <QVector>
+#include <QtGlobal>
+
+#include "doubledouble.h"
+
+class QDataStream;
+
+//Signed fixed point number with an arbitrary count of 32 bit fraction limbs,
+//used for the parts of deep zooms which need more than double precision.
+//Results of operations have the fraction limbs of the more precise operand,
+//multiplication truncates toward zero.
+class FixedPoint
+{
+public:
+    enum {IntegerLimbs = 1};
+
+    FixedPoint();
+    //Converts the value exactly, with as many fraction limbs as it needs
+    explicit FixedPoint(double value);
+    FixedPoint(double value, int fractionLimbs);
+
+    int fractionLimbs() const;
+    FixedPoint withFractionLimbs(int fractionLimbs) const;
+    double toDouble() const;
+    //About 106 significant bits, for kernels which iterate in double-double
+    DoubleDouble toDoubleDouble() const;
+    bool isNegative() const;
+    bool isZero() const;
+
+    FixedPoint operator-() const;
+    FixedPoint& operator+=(const FixedPoint& other);
+    FixedPoint& operator-=(const FixedPoint& other);
+
+    friend FixedPoint operator+(FixedPoint a, const FixedPoint& b) { return a += b; }
+    friend FixedPoint operator-(FixedPoint a, const FixedPoint& b) { return a -= b; }
+    friend FixedPoint operator*(const FixedPoint& a, const FixedPoint& b);
+
+    //Count of fraction limbs needed to resolve steps of the given size
+    static int fractionLimbsFor(double resolution);
+
+    //Exact value, for views sent to other processes
+    friend QDataStream& operator<<(QDataStream& stream, const FixedPoint& value);
+    friend QDataStream& operator>>(QDataStream& stream, FixedPoint& value);
+
+private:
+    void addMagnitude(const FixedPoint& other);
+    void subtractMagnitude(const FixedPoint& other);
+    int compareMagnitude(const FixedPoint& other) const;
+    void normalizeSign();
+
+private:
+    //Magnitude, least significant limb first. The last IntegerLimbs limbs
+    //hold the integer part.
+    QVector<quint32> limbs;
+    int fraction;
+    bool negative;
+};
+
+#endif // FIXEDPOINT_H
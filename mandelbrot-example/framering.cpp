@@ -0,0 +1,125 @@
+#include "framering.h"
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <QVector>
+
+struct FrameRing::Buffer
+{
+    Shared* shared = nullptr;
+    QVector<uint> pixels;
+    QSize size;
+    bool busy = false;
+};
+
+struct FrameRing::Shared
+{
+    mutable QMutex mutex;
+    QVector<Buffer*> buffers;
+    Stats counters;
+    //Ring and every busy buffer hold one
+    int references = 1;
+    //Ring is gone, returned buffers are freed
+    bool closed = false;
+};
+
+FrameRing::FrameRing(int bufferCount) :
+    shared(new Shared)
+{
+    for(int i = 0; i < qMax(1, bufferCount); ++i)
+    {
+        Buffer* buffer = new Buffer;
+        buffer->shared = shared;
+        shared->buffers.append(buffer);
+    }
+}
+
+FrameRing::~FrameRing()
+{
+    shared->mutex.lock();
+    shared->closed = true;
+    for(int i = shared->buffers.size() - 1; i >= 0; --i)
+    {
+        if(!shared->buffers.at(i)->busy)
+        {
+            delete shared->buffers.takeAt(i);
+        }
+    }
+    const bool last = --shared->references == 0;
+    shared->mutex.unlock();
+
+    if(last)
+    {
+        delete shared;
+    }
+}
+
+QImage FrameRing::acquire(QSize size)
+{
+    if(size.isEmpty())
+    {
+        return QImage();
+    }
+
+    QMutexLocker lock(&shared->mutex);
+    Buffer* freeBuffer = nullptr;
+    for(Buffer* buffer : qAsConst(shared->buffers))
+    {
+        //Free buffer of the same size keeps its memory
+        if(!buffer->busy && (!freeBuffer || buffer->size == size))
+        {
+            freeBuffer = buffer;
+        }
+    }
+
+    if(!freeBuffer)
+    {
+        //Receivers still hold every buffer, the image gets memory of its own
+        ++shared->counters.allocated;
+        return QImage(size, QImage::Format_RGB32);
+    }
+
+    if(freeBuffer->size != size)
+    {
+        freeBuffer->pixels.resize(size.width() * size.height());
+        freeBuffer->pixels.squeeze();
+        freeBuffer->size = size;
+        ++shared->counters.allocated;
+    }
+    else
+    {
+        ++shared->counters.reused;
+    }
+
+    freeBuffer->busy = true;
+    ++shared->references;
+    return QImage(reinterpret_cast<uchar*>(freeBuffer->pixels.data()), size.width(), size.height(),
+                  size.width() * int(sizeof(uint)), QImage::Format_RGB32, &FrameRing::release, freeBuffer);
+}
+
+FrameRing::Stats FrameRing::stats() const
+{
+    QMutexLocker lock(&shared->mutex);
+    return shared->counters;
+}
+
+void FrameRing::release(void* info)
+{
+    Buffer* buffer = static_cast<Buffer*>(info);
+    Shared* shared = buffer->shared;
+
+    shared->mutex.lock();
+    buffer->busy = false;
+    if(shared->closed)
+    {
+        shared->buffers.removeOne(buffer);
+        delete buffer;
+    }
+    const bool last = --shared->references == 0;
+    shared->mutex.unlock();
+
+    if(last)
+    {
+        delete shared;
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef FRAMERING_H
+#define FRAMERING_H
+
+#include <QImage>
+#include <QSize>
+#include <QtGlobal>
+
+//Preallocated images the render thread draws into and hands over to the
+//receivers of its signals without copying. A buffer is busy while any copy
+//of the image acquire() made of it exists, the last copy to go away returns
+//it to the ring, in whatever thread that happens. Memory of a buffer is kept
+//as long as the images have the same size. All members are thread safe.
+class FrameRing
+{
+public:
+    struct Stats
+    {
+        //Images of a free buffer of the right size
+        qint64 reused = 0;
+        //Images which needed memory, because their size changed or every
+        //buffer was still held by a receiver
+        qint64 allocated = 0;
+    };
+
+    explicit FrameRing(int bufferCount = 3);
+    ~FrameRing();
+
+    //Image of a free buffer with undefined contents, the writer has to hold
+    //the only copy of it while it draws
+    QImage acquire(QSize size);
+
+    Stats stats() const;
+
+private:
+    struct Shared;
+    struct Buffer;
+
+    static void release(void* buffer);
+
+    //Outlives the ring while the receivers hold images of it
+    Shared* shared;
+
+    Q_DISABLE_COPY(FrameRing)
+};
+
+#endif // FRAMERING_H
@@ -0,0 +1,473 @@
+#include "imageexporter.h"
+
+#include "perturbation.h"
+#include "tilefarm.h"
+
+#include <QFile>
+#include <QColor>
+#include <QByteArray>
+#include <QVector>
+#include <QMutexLocker>
+
+namespace
+{
+//Pixels per kernel call, limits the buffer of the escape magnitudes
+const int MagnitudeChunk = 256;
+
+//Classic TIFF has 32 bit file offsets
+const qint64 MaxTiffBytes = Q_INT64_C(0xffffffff);
+
+void appendShort(QByteArray* data, quint16 value)
+{
+    data->append(char(value & 0xff));
+    data->append(char(value >> 8));
+}
+
+void appendLong(QByteArray* data, quint32 value)
+{
+    appendShort(data, quint16(value & 0xffff));
+    appendShort(data, quint16(value >> 16));
+}
+
+enum TiffType
+{
+    TiffShort = 3,
+    TiffLong = 4,
+    TiffRational = 5
+};
+
+void appendEntry(QByteArray* data, quint16 tag, TiffType type, quint32 count, quint32 value)
+{
+    appendShort(data, tag);
+    appendShort(data, type);
+    appendLong(data, count);
+    //Single shorts are stored in the first half of the value field
+    appendLong(data, value);
+}
+
+//Little endian baseline TIFF header of an uncompressed RGB image, followed
+//by the strips of stripHeight rows, each stripBytes apart
+QByteArray tiffHeader(QSize size, int stripHeight, qint64* dataOffset)
+{
+    const quint32 stripCount = quint32((size.height() + stripHeight - 1) / stripHeight);
+    const quint32 stripBytes = quint32(size.width()) * 3 * quint32(stripHeight);
+    const int EntryCount = 13;
+    const quint32 ifdOffset = 8;
+    const quint32 bitsOffset = ifdOffset + 2 + EntryCount * 12 + 4;
+    const quint32 resolutionOffset = bitsOffset + 3 * 2;
+    const quint32 offsetsOffset = resolutionOffset + 2 * 8;
+    const quint32 countsOffset = offsetsOffset + 4 * stripCount;
+    const quint32 pixelsOffset = countsOffset + 4 * stripCount;
+
+    QByteArray header;
+    header.append("II*\0", 4);
+    appendLong(&header, ifdOffset);
+
+    //Entries are sorted by their tag
+    appendShort(&header, EntryCount);
+    appendEntry(&header, 256, TiffLong, 1, quint32(size.width()));
+    appendEntry(&header, 257, TiffLong, 1, quint32(size.height()));
+    appendEntry(&header, 258, TiffShort, 3, bitsOffset);
+    //No compression, RGB
+    appendEntry(&header, 259, TiffShort, 1, 1);
+    appendEntry(&header, 262, TiffShort, 1, 2);
+    appendEntry(&header, 273, TiffLong, stripCount, stripCount == 1 ? pixelsOffset : offsetsOffset);
+    appendEntry(&header, 277, TiffShort, 1, 3);
+    appendEntry(&header, 278, TiffLong, 1, quint32(stripHeight));
+    appendEntry(&header, 279, TiffLong, stripCount, stripCount == 1 ? quint32(size.width()) * 3 * quint32(size.height()) :
+                                                                      countsOffset);
+    appendEntry(&header, 282, TiffRational, 1, resolutionOffset);
+    appendEntry(&header, 283, TiffRational, 1, resolutionOffset + 8);
+    appendEntry(&header, 284, TiffShort, 1, 1);
+    //Resolution in inches
+    appendEntry(&header, 296, TiffShort, 1, 2);
+    appendLong(&header, 0);
+
+    for(int channel = 0; channel < 3; ++channel)
+    {
+        appendShort(&header, 8);
+    }
+    for(int axis = 0; axis < 2; ++axis)
+    {
+        appendLong(&header, 300);
+        appendLong(&header, 1);
+    }
+    for(quint32 strip = 0; strip < stripCount; ++strip)
+    {
+        appendLong(&header, pixelsOffset + strip * stripBytes);
+    }
+    for(quint32 strip = 0; strip < stripCount; ++strip)
+    {
+        const int rows = qMin(stripHeight, size.height() - int(strip) * stripHeight);
+        appendLong(&header, quint32(size.width()) * 3 * quint32(rows));
+    }
+
+    *dataOffset = pixelsOffset;
+    return header;
+}
+}
+
+struct ImageExporter::Job
+{
+    QSize size;
+    double centerX = 0;
+    double centerY = 0;
+    double scaleFactor = 0;
+    int maxIterations = 0;
+    EscapeKernel::Precision precision = EscapeKernel::DoublePrecision;
+    //Float and double kernel, double-double rows take the wide centers
+    EscapeKernel::RowFunction kernel = nullptr;
+    DoubleDouble wideCenterX;
+    DoubleDouble wideCenterY;
+    int interiorChecks = 0;
+    EscapeKernel::Fractal fractal;
+    //Set in deep zoom, pixels are then computed off the reference orbit
+    const Perturbation::ReferenceOrbit* orbit = nullptr;
+    Palette palette;
+
+    int stripHeight = 0;
+    int stripCount = 0;
+    qint64 dataOffset = 0;
+    QAtomicInt nextStrip;
+    QAtomicInt finishedRows;
+
+    //Strips are written in any order, each at its own offset
+    QFile* file = nullptr;
+    QMutex fileMutex;
+    QAtomicInt writeFailed;
+};
+
+ImageExporter::ImageExporter(QObject* parent) : QThread(parent),
+    kernelInstructionSet(EscapeKernel::bestInstructionSet())
+{
+}
+
+ImageExporter::~ImageExporter()
+{
+    cancel();
+    wait();
+}
+
+bool ImageExporter::exportImage(const QString &fileName, const FixedPoint &centerX, const FixedPoint &centerY,
+                                double scaleFactor, QSize size)
+{
+    QMutexLocker lock(&mutex);
+    if(isRunning() || size.isEmpty())
+    {
+        return false;
+    }
+
+    this->fileName = fileName;
+    this->centerX = centerX;
+    this->centerY = centerY;
+    this->scaleFactor = scaleFactor;
+    this->size = size;
+    abort.storeRelaxed(0);
+    start(LowPriority);
+    return true;
+}
+
+void ImageExporter::cancel()
+{
+    abort.storeRelaxed(1);
+}
+
+void ImageExporter::setThreadCount(int threadCount)
+{
+    pool.setMaxThreadCount(qMax(1, threadCount));
+}
+
+void ImageExporter::setInstructionSet(EscapeKernel::InstructionSet instructionSet)
+{
+    QMutexLocker lock(&mutex);
+    kernelInstructionSet = EscapeKernel::isSupported(instructionSet) ?
+                instructionSet : EscapeKernel::bestInstructionSet();
+}
+
+void ImageExporter::setInteriorChecks(int interiorChecks)
+{
+    QMutexLocker lock(&mutex);
+    kernelInteriorChecks = interiorChecks;
+}
+
+void ImageExporter::setFractal(const EscapeKernel::Fractal &fractal)
+{
+    QMutexLocker lock(&mutex);
+    kernelFractal = fractal;
+}
+
+void ImageExporter::setMaxIterations(int maxIterations)
+{
+    QMutexLocker lock(&mutex);
+    this->maxIterations = qMax(1, maxIterations);
+}
+
+void ImageExporter::setPalette(const Palette &palette)
+{
+    QMutexLocker lock(&mutex);
+    this->palette = palette;
+}
+
+void ImageExporter::setStripHeight(int rows)
+{
+    QMutexLocker lock(&mutex);
+    stripHeight = qMax(1, rows);
+}
+
+void ImageExporter::setWorkers(const QStringList &addresses)
+{
+    QMutexLocker lock(&mutex);
+    workers = addresses;
+}
+
+ImageExporter::Stats ImageExporter::stats() const
+{
+    QMutexLocker lock(&mutex);
+    return counters;
+}
+
+void ImageExporter::run()
+{
+    mutex.lock();
+    const QString fileName = this->fileName;
+    const FixedPoint centerX = this->centerX;
+    const FixedPoint centerY = this->centerY;
+    Job job;
+    job.size = size;
+    job.centerX = centerX.toDouble();
+    job.centerY = centerY.toDouble();
+    job.scaleFactor = scaleFactor;
+    job.maxIterations = maxIterations;
+    job.precision = EscapeKernel::precisionFor(job.centerX, job.centerY, job.scaleFactor, size.width(),
+                                               size.height(), maxIterations);
+    job.kernel = EscapeKernel::rowFunction(kernelInstructionSet, job.precision, kernelFractal.formula);
+    job.wideCenterX = centerX.toDoubleDouble();
+    job.wideCenterY = centerY.toDoubleDouble();
+    job.interiorChecks = kernelInteriorChecks;
+    job.fractal = kernelFractal;
+    job.palette = palette;
+    job.stripHeight = qMin(stripHeight, size.height());
+    const QStringList workers = this->workers;
+    counters = Stats();
+    mutex.unlock();
+
+    job.stripCount = (job.size.height() + job.stripHeight - 1) / job.stripHeight;
+    const QByteArray header = tiffHeader(job.size, job.stripHeight, &job.dataOffset);
+    if(job.dataOffset + qint64(job.size.width()) * job.size.height() * 3 > MaxTiffBytes)
+    {
+        emit exportFailed(fileName, tr("The image is larger than a TIFF file can hold"));
+        return;
+    }
+
+    QFile file(fileName);
+    if(!file.open(QIODevice::WriteOnly) || file.write(header) != header.size())
+    {
+        emit exportFailed(fileName, file.errorString());
+        return;
+    }
+    job.file = &file;
+
+    QString error = tr("Cancelled");
+    bool rendered = false;
+    if(workers.isEmpty())
+    {
+        Perturbation::ReferenceOrbit orbit;
+        if(job.fractal.formula == EscapeKernel::Mandelbrot && job.scaleFactor < Perturbation::DeepZoomScale)
+        {
+            //Reference orbit needs the precision of the center and of the pixel steps
+            const int fractionLimbs = qMax(qMax(centerX.fractionLimbs(), centerY.fractionLimbs()),
+                                           FixedPoint::fractionLimbsFor(job.scaleFactor));
+            orbit.reset(centerX, centerY, fractionLimbs);
+            orbit.extend(EscapeKernel::stepLimit(job.maxIterations) + 2, [this]() { return isCancelled(); });
+            job.orbit = &orbit;
+        }
+
+        const int threads = qMin(pool.maxThreadCount(), job.stripCount);
+        for(int i = 1; i < threads; ++i)
+        {
+            pool.start([this, &job]()
+            {
+                QThread::currentThread()->setPriority(QThread::LowPriority);
+                renderStrips(job);
+            });
+        }
+        renderStrips(job);
+        pool.waitForDone();
+        rendered = !isCancelled();
+    }
+    else
+    {
+        rendered = renderOnWorkers(job, centerX, centerY, &error);
+    }
+
+    if(!rendered || job.writeFailed.loadRelaxed())
+    {
+        if(job.writeFailed.loadRelaxed())
+        {
+            error = file.errorString();
+        }
+        file.remove();
+        emit exportFailed(fileName, error);
+        return;
+    }
+
+    file.close();
+    emit exported(fileName);
+}
+
+void ImageExporter::renderStrips(Job &job)
+{
+    const int width = job.size.width();
+    const int stepLimit = EscapeKernel::stepLimit(job.maxIterations);
+    QVector<int> iterations(width);
+    QVector<quint8> fractions(width);
+    QVector<uint> colors(width);
+    QByteArray strip;
+    float magnitudes[MagnitudeChunk];
+
+    forever
+    {
+        const int index = job.nextStrip.fetchAndAddRelaxed(1);
+        if(index >= job.stripCount || isCancelled() || job.writeFailed.loadRelaxed())
+        {
+            break;
+        }
+
+        const int top = index * job.stripHeight;
+        const int rows = qMin(job.stripHeight, job.size.height() - top);
+        strip.resize(width * 3 * rows);
+        uchar* pixels = reinterpret_cast<uchar*>(strip.data());
+        for(int y = top; y < top + rows; ++y)
+        {
+            if(isCancelled())
+            {
+                return;
+            }
+
+            //Same pixel positions as the interactive render, relative to the center
+            const int row = y - job.size.height() / 2;
+            const double ay = job.centerY + (row * job.scaleFactor);
+            const DoubleDouble wideAy = job.wideCenterY + (DoubleDouble(row) * DoubleDouble(job.scaleFactor));
+            for(int done = 0; done < width; done += MagnitudeChunk)
+            {
+                const int chunk = qMin(MagnitudeChunk, width - done);
+                const int column = done - width / 2;
+                int* chunkIterations = iterations.data() + done;
+                if(job.orbit)
+                {
+                    int rebases = 0;
+                    Perturbation::row(*job.orbit, job.scaleFactor, column, row, chunk, job.maxIterations,
+                                      chunkIterations, magnitudes, &rebases);
+                }
+                else if(job.precision == EscapeKernel::DoubleDoublePrecision)
+                {
+                    EscapeKernel::doubleDoubleRow(job.wideCenterX, job.scaleFactor, column, wideAy, chunk,
+                                                  job.maxIterations, job.interiorChecks, chunkIterations, magnitudes,
+                                                  nullptr, job.fractal);
+                }
+                else
+                {
+                    job.kernel(job.centerX, job.scaleFactor, column, ay, chunk, job.maxIterations, job.interiorChecks,
+                               chunkIterations, magnitudes, nullptr, job.fractal);
+                }
+
+                for(int k = 0; k < chunk; ++k)
+                {
+                    fractions[done + k] = chunkIterations[k] < stepLimit ? Palette::fraction(magnitudes[k]) : 0;
+                }
+            }
+
+            colorRow(job, iterations.constData(), fractions.constData(), colors.data(), pixels);
+            pixels += width * 3;
+        }
+
+        if(!writeStrip(job, index, strip))
+        {
+            return;
+        }
+    }
+}
+
+bool ImageExporter::renderOnWorkers(Job &job, const FixedPoint &centerX, const FixedPoint &centerY, QString *error)
+{
+    //Strips are the tiles, the workers compute them with their own kernels
+    QVector<TileFarm::Tile> tiles;
+    for(int index = 0; index < job.stripCount; ++index)
+    {
+        TileFarm::Tile tile;
+        tile.id = index;
+        tile.centerX = centerX;
+        tile.centerY = centerY;
+        tile.scaleFactor = job.scaleFactor;
+        tile.imageSize = job.size;
+        const int top = index * job.stripHeight;
+        tile.rect = QRect(0, top, job.size.width(), qMin(job.stripHeight, job.size.height() - top));
+        tile.maxIterations = job.maxIterations;
+        tile.interiorChecks = job.interiorChecks;
+        tile.fractal = job.fractal;
+        tiles.append(tile);
+    }
+
+    QMutexLocker lock(&mutex);
+    TileFarm farm(workers);
+    lock.unlock();
+
+    const int width = job.size.width();
+    QVector<uint> colors(width);
+    QByteArray strip;
+    const bool rendered = farm.render(tiles, [&](const TileFarm::Result& result)
+    {
+        const int rows = result.iterations.size() / width;
+        strip.resize(width * 3 * rows);
+        uchar* pixels = reinterpret_cast<uchar*>(strip.data());
+        for(int y = 0; y < rows; ++y)
+        {
+            colorRow(job, result.iterations.constData() + y * width, result.fractions.constData() + y * width,
+                     colors.data(), pixels + y * width * 3);
+        }
+        writeStrip(job, result.id, strip);
+    }, [this, &job]() { return isCancelled() || job.writeFailed.loadRelaxed(); }, error);
+
+    const TileFarm::Stats stats = farm.stats();
+    lock.relock();
+    counters.workerStrips = stats.workerTiles;
+    counters.retries = stats.retries;
+    counters.failedWorkers = stats.failedWorkers;
+    counters.failures = stats.failures;
+    return rendered;
+}
+
+void ImageExporter::colorRow(const Job &job, const int *iterations, const quint8 *fractions, uint *colors,
+                             uchar *pixels)
+{
+    const int width = job.size.width();
+    job.palette.colorize(iterations, fractions, width, job.maxIterations, colors);
+    for(int x = 0; x < width; ++x)
+    {
+        *pixels++ = uchar(qRed(colors[x]));
+        *pixels++ = uchar(qGreen(colors[x]));
+        *pixels++ = uchar(qBlue(colors[x]));
+    }
+}
+
+bool ImageExporter::writeStrip(Job &job, int index, const QByteArray &strip)
+{
+    const int width = job.size.width();
+    const int rows = strip.size() / (width * 3);
+    {
+        QMutexLocker lock(&job.fileMutex);
+        const qint64 offset = job.dataOffset + qint64(index) * width * 3 * job.stripHeight;
+        if(!job.file->seek(offset) || job.file->write(strip) != strip.size())
+        {
+            job.writeFailed.storeRelaxed(1);
+            return false;
+        }
+    }
+    emit progress(job.finishedRows.fetchAndAddRelaxed(rows) + rows, job.size.height());
+    return true;
+}
+
+bool ImageExporter::isCancelled() const
+{
+    return abort.loadRelaxed();
+}
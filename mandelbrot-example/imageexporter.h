@@ -0,0 +1,99 @@
+#ifndef IMAGEEXPORTER_H
+#define IMAGEEXPORTER_H
+
+#include <QThread>
+#include <QMutex>
+#include <QSize>
+#include <QString>
+#include <QStringList>
+#include <QThreadPool>
+#include <QVector>
+#include <QAtomicInt>
+
+#include "escapekernel.h"
+#include "fixedpoint.h"
+#include "palette.h"
+
+//Renders images too large for one QImage, e.g. 32k x 32k for print. Strips
+//of rows are computed in parallel and written straight into an uncompressed
+//TIFF file, so memory stays bounded by a few strips per worker.
+class ImageExporter : public QThread
+{
+    Q_OBJECT
+public:
+    //Of the last export
+    struct Stats
+    {
+        //Strips of each mandelbrot-worker, in the order of the addresses.
+        //Empty when the threads of this process rendered the export.
+        QVector<qint64> workerStrips;
+        //Strips sent again after their worker failed
+        qint64 retries = 0;
+        int failedWorkers = 0;
+        //Address and reason of every failed worker
+        QStringList failures;
+    };
+
+    explicit ImageExporter(QObject* parent = nullptr);
+    ~ImageExporter();
+
+    //Starts the export in the background, returns false while one is still
+    //running. Pixel positions follow the conventions of RenderThread.
+    bool exportImage(const QString& fileName, const FixedPoint& centerX, const FixedPoint& centerY,
+                     double scaleFactor, QSize size);
+    //Stops the running export and removes its file
+    void cancel();
+
+    //Settings apply to the next export
+    void setThreadCount(int threadCount);
+    void setInstructionSet(EscapeKernel::InstructionSet instructionSet);
+    void setInteriorChecks(int interiorChecks);
+    void setFractal(const EscapeKernel::Fractal& fractal);
+    void setMaxIterations(int maxIterations);
+    void setPalette(const Palette& palette);
+    void setStripHeight(int rows);
+    //Strips are computed by mandelbrot-worker processes at these addresses,
+    //see TileFarm, instead of the threads of this one
+    void setWorkers(const QStringList& addresses);
+
+    Stats stats() const;
+
+signals:
+    //Emitted from the workers, whenever a strip was written
+    void progress(int finishedRows, int rows);
+    void exported(const QString& fileName);
+    void exportFailed(const QString& fileName, const QString& error);
+
+protected:
+    void run() override;
+
+private:
+    struct Job;
+
+    void renderStrips(Job& job);
+    bool renderOnWorkers(Job& job, const FixedPoint& centerX, const FixedPoint& centerY, QString* error);
+    static void colorRow(const Job& job, const int* iterations, const quint8* fractions, uint* colors,
+                         uchar* pixels);
+    bool writeStrip(Job& job, int index, const QByteArray& strip);
+    bool isCancelled() const;
+
+private:
+    mutable QMutex mutex;
+    QThreadPool pool;
+    QString fileName;
+    FixedPoint centerX;
+    FixedPoint centerY;
+    double scaleFactor = 0;
+    QSize size;
+    EscapeKernel::InstructionSet kernelInstructionSet;
+    int kernelInteriorChecks = EscapeKernel::CardioidCheck | EscapeKernel::PeriodicityCheck;
+    EscapeKernel::Fractal kernelFractal;
+    int maxIterations = 4096;
+    Palette palette;
+    int stripHeight = 64;
+    QStringList workers;
+    Stats counters;
+    QAtomicInt abort;
+};
+
+#endif // IMAGEEXPORTER_H
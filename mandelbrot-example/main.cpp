@@ -1,12 +1,449 @@
 #include <QApplication>
+#include <QCommandLineParser>
+#include <QDebug>
+#include <QDir>
+#include <QStandardPaths>
+#include <QElapsedTimer>
+#include "imageexporter.h"
 #include "mandlebrotwidget.h"
+#include "zoomanimation.h"
+
+namespace
+{
+//View given as x,y,scale
+bool parseView(const QString& text, ZoomAnimation::View* view)
+{
+    const QStringList values = text.split(QLatin1Char(','));
+    bool valid = values.size() == 3;
+    for(int i = 0; i < values.size() && valid; ++i)
+    {
+        values.at(i).toDouble(&valid);
+    }
+    if(!valid || values.at(2).toDouble() <= 0)
+    {
+        return false;
+    }
+
+    view->centerX = FixedPoint(values.at(0).toDouble());
+    view->centerY = FixedPoint(values.at(1).toDouble());
+    view->scaleFactor = values.at(2).toDouble();
+    return true;
+}
+}
 
 int main (int argc, char** argv)
 {
     QCoreApplication::setAttribute(Qt::AA_EnableHighDpiScaling);
     QCoreApplication::setAttribute(Qt::AA_UseHighDpiPixmaps);
     QApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Mandelbrot"));
+    parser.addHelpOption();
+    QCommandLineOption threadsOption(QStringList() << QStringLiteral("t") << QStringLiteral("threads"),
+                                     QStringLiteral("Number of threads used for rendering."),
+                                     QStringLiteral("count"));
+    parser.addOption(threadsOption);
+    QCommandLineOption kernelOption(QStringList() << QStringLiteral("k") << QStringLiteral("kernel"),
+                                    QStringLiteral("Escape time kernel: scalar, avx2 or avx512."),
+                                    QStringLiteral("name"));
+    parser.addOption(kernelOption);
+    QCommandLineOption bandsOption(QStringList() << QStringLiteral("b") << QStringLiteral("bands"),
+                                   QStringLiteral("Deliver refining passes in bands of the given height."),
+                                   QStringLiteral("scanlines"));
+    parser.addOption(bandsOption);
+    QCommandLineOption interiorOption(QStringList() << QStringLiteral("i") << QStringLiteral("interior"),
+                                      QStringLiteral("Interior shortcuts: all, none, cardioid or periodicity."),
+                                      QStringLiteral("checks"));
+    parser.addOption(interiorOption);
+    QCommandLineOption formulaOption(QStringList() << QStringLiteral("f") << QStringLiteral("formula"),
+                                     QStringLiteral("Fractal: mandelbrot, julia, burning-ship or multibrot3. "
+                                                    "Animations are of the Mandelbrot set."),
+                                     QStringLiteral("name"));
+    parser.addOption(formulaOption);
+    QCommandLineOption juliaOption(QStringList() << QStringLiteral("julia"),
+                                   QStringLiteral("Constant of the Julia set, implies --formula julia."),
+                                   QStringLiteral("x,y"));
+    parser.addOption(juliaOption);
+    QCommandLineOption subdivideOption(QStringList() << QStringLiteral("s") << QStringLiteral("subdivide"),
+                                       QStringLiteral("Fill uniform rectangles without computing them: none, previews or all."),
+                                       QStringLiteral("passes"));
+    parser.addOption(subdivideOption);
+    QCommandLineOption deepZoomOption(QStringList() << QStringLiteral("d") << QStringLiteral("deep-zoom"),
+                                      QStringLiteral("Perturbation deep zoom: auto, on or off."),
+                                      QStringLiteral("mode"));
+    parser.addOption(deepZoomOption);
+    QCommandLineOption cacheOption(QStringList() << QStringLiteral("c") << QStringLiteral("cache-size"),
+                                   QStringLiteral("Memory of the tile cache, 0 disables it."),
+                                   QStringLiteral("MiB"));
+    parser.addOption(cacheOption);
+    QCommandLineOption diskCacheOption(QStringList() << QStringLiteral("disk-cache"),
+                                       QStringLiteral("Size of the file keeping tiles across runs, 256 by default, 0 disables it."),
+                                       QStringLiteral("MiB"));
+    parser.addOption(diskCacheOption);
+    QCommandLineOption previewOption(QStringList() << QStringLiteral("p") << QStringLiteral("preview-budget"),
+                                     QStringLiteral("Time for a low resolution preview of a new view, 0 disables it."),
+                                     QStringLiteral("ms"));
+    parser.addOption(previewOption);
+    QCommandLineOption speculateOption(QStringList() << QStringLiteral("speculate"),
+                                       QStringLiteral("Zoom levels rendered ahead of the wheel, 0 disables it."),
+                                       QStringLiteral("levels"));
+    parser.addOption(speculateOption);
+    QCommandLineOption antialiasOption(QStringList() << QStringLiteral("a") << QStringLiteral("antialias"),
+                                       QStringLiteral("Samples per axis of the pixels on edges after the last pass, 0 disables it."),
+                                       QStringLiteral("grid"));
+    parser.addOption(antialiasOption);
+    QCommandLineOption smoothOption(QStringList() << QStringLiteral("smooth"),
+                                    QStringLiteral("Smooth coloring from the fractional escape time."));
+    parser.addOption(smoothOption);
+    QCommandLineOption cycleOption(QStringList() << QStringLiteral("cycle"),
+                                   QStringLiteral("Cycle the colors of the palette."));
+    parser.addOption(cycleOption);
+    QCommandLineOption exportSizeOption(QStringList() << QStringLiteral("export-size"),
+                                        QStringLiteral("Size of exported images, 8192x8192 by default."),
+                                        QStringLiteral("WxH"));
+    parser.addOption(exportSizeOption);
+    QCommandLineOption overlayOption(QStringList() << QStringLiteral("o") << QStringLiteral("overlay"),
+                                     QStringLiteral("Show the render statistics on top of the image."));
+    parser.addOption(overlayOption);
+    QCommandLineOption statsOption(QStringList() << QStringLiteral("stats"),
+                                   QStringLiteral("Print the render statistics when the window is closed."));
+    parser.addOption(statsOption);
+    QCommandLineOption animateOption(QStringList() << QStringLiteral("animate"),
+                                     QStringLiteral("Write the frames of a zoom from --from to --to into the directory and quit."),
+                                     QStringLiteral("directory"));
+    parser.addOption(animateOption);
+    QCommandLineOption fromOption(QStringList() << QStringLiteral("from"),
+                                  QStringLiteral("First view of the animation."),
+                                  QStringLiteral("x,y,scale"));
+    parser.addOption(fromOption);
+    QCommandLineOption toOption(QStringList() << QStringLiteral("to"),
+                                QStringLiteral("Last view of the animation."),
+                                QStringLiteral("x,y,scale"));
+    parser.addOption(toOption);
+    QCommandLineOption framesOption(QStringList() << QStringLiteral("frames"),
+                                    QStringLiteral("Frames of the animation, 300 by default."),
+                                    QStringLiteral("count"));
+    parser.addOption(framesOption);
+    QCommandLineOption frameSizeOption(QStringList() << QStringLiteral("frame-size"),
+                                       QStringLiteral("Size of the frames, 1920x1080 by default."),
+                                       QStringLiteral("WxH"));
+    parser.addOption(frameSizeOption);
+    QCommandLineOption frameFormatOption(QStringList() << QStringLiteral("frame-format"),
+                                         QStringLiteral("Image format of the frames, png by default."),
+                                         QStringLiteral("format"));
+    parser.addOption(frameFormatOption);
+    QCommandLineOption noFrameReuseOption(QStringList() << QStringLiteral("no-frame-reuse"),
+                                          QStringLiteral("Compute every pixel of every frame of the animation."));
+    parser.addOption(noFrameReuseOption);
+    QCommandLineOption exportOption(QStringList() << QStringLiteral("export"),
+                                    QStringLiteral("Export --view as a TIFF file and quit."),
+                                    QStringLiteral("file"));
+    parser.addOption(exportOption);
+    QCommandLineOption viewOption(QStringList() << QStringLiteral("view"),
+                                  QStringLiteral("View to export, with the size of a pixel as scale."),
+                                  QStringLiteral("x,y,scale"));
+    parser.addOption(viewOption);
+    QCommandLineOption farmOption(QStringList() << QStringLiteral("farm"),
+                                  QStringLiteral("Export on mandelbrot-worker processes, local server names or host:port."),
+                                  QStringLiteral("addresses"));
+    parser.addOption(farmOption);
+    parser.process(app);
+
+    EscapeKernel::InstructionSet instructionSet = EscapeKernel::bestInstructionSet();
+    if(parser.isSet(kernelOption))
+    {
+        const QString kernel = parser.value(kernelOption);
+        for(auto candidate : {EscapeKernel::Scalar, EscapeKernel::Avx2, EscapeKernel::Avx512})
+        {
+            if(kernel == QLatin1String(EscapeKernel::name(candidate)))
+            {
+                instructionSet = candidate;
+            }
+        }
+    }
+
+    EscapeKernel::Fractal fractal;
+    if(parser.isSet(formulaOption))
+    {
+        const QString formula = parser.value(formulaOption);
+        for(auto candidate : {EscapeKernel::Mandelbrot, EscapeKernel::Julia, EscapeKernel::BurningShip,
+                              EscapeKernel::Multibrot3})
+        {
+            if(formula == QLatin1String(EscapeKernel::name(candidate)))
+            {
+                fractal.formula = candidate;
+            }
+        }
+    }
+    if(parser.isSet(juliaOption))
+    {
+        const QStringList values = parser.value(juliaOption).split(QLatin1Char(','));
+        bool validX = false;
+        bool validY = false;
+        if(values.size() == 2)
+        {
+            fractal.juliaX = values.at(0).toDouble(&validX);
+            fractal.juliaY = values.at(1).toDouble(&validY);
+        }
+        if(!validX || !validY)
+        {
+            qCritical() << "The Julia constant needs to be given as x,y";
+            return 1;
+        }
+        fractal.formula = EscapeKernel::Julia;
+    }
+
+    QStringList workers;
+    if(parser.isSet(farmOption))
+    {
+        workers = parser.value(farmOption).split(QLatin1Char(','), Qt::SkipEmptyParts);
+    }
+    QSize exportSize(8192, 8192);
+    if(parser.isSet(exportSizeOption))
+    {
+        const QStringList size = parser.value(exportSizeOption).split(QLatin1Char('x'));
+        if(size.size() == 2 && size.at(0).toInt() > 0 && size.at(1).toInt() > 0)
+        {
+            exportSize = QSize(size.at(0).toInt(), size.at(1).toInt());
+        }
+    }
+
+    if(parser.isSet(exportOption))
+    {
+        ZoomAnimation::View view;
+        if(!parseView(parser.value(viewOption), &view))
+        {
+            qCritical() << "The export needs --view as x,y,scale";
+            return 1;
+        }
+
+        ImageExporter exporter;
+        if(parser.isSet(threadsOption))
+        {
+            exporter.setThreadCount(parser.value(threadsOption).toInt());
+        }
+        exporter.setInstructionSet(instructionSet);
+        exporter.setFractal(fractal);
+        exporter.setWorkers(workers);
+        Palette palette;
+        palette.setSmooth(parser.isSet(smoothOption));
+        exporter.setPalette(palette);
+        exporter.setMaxIterations(RenderThread::passIterations(RenderThread::PassCount - 1));
+
+        int result = 0;
+        QObject::connect(&exporter, &ImageExporter::exported, &app, &QCoreApplication::quit);
+        QObject::connect(&exporter, &ImageExporter::exportFailed, [&result](const QString& fileName,
+                                                                           const QString& error)
+        {
+            qCritical().nospace() << "Export " << fileName << " failed: " << error;
+            result = 1;
+            QCoreApplication::quit();
+        });
+        QElapsedTimer timer;
+        timer.start();
+        if(!exporter.exportImage(parser.value(exportOption), view.centerX, view.centerY, view.scaleFactor,
+                                 exportSize))
+        {
+            qCritical() << "Invalid export";
+            return 1;
+        }
+        app.exec();
+        qInfo().nospace() << "Exported in " << timer.elapsed() << " ms";
+
+        const ImageExporter::Stats stats = exporter.stats();
+        if(!stats.workerStrips.isEmpty())
+        {
+            qInfo().nospace() << "Export on " << stats.workerStrips.size() << " workers, strips per worker: "
+                              << stats.workerStrips << ", retried: " << stats.retries
+                              << ", failed workers: " << stats.failedWorkers;
+        }
+        for(const QString& failure : stats.failures)
+        {
+            qWarning().noquote() << "Worker failed:" << failure;
+        }
+        return result;
+    }
+
+    if(parser.isSet(animateOption))
+    {
+        ZoomAnimation::View from;
+        ZoomAnimation::View to;
+        if(!parseView(parser.value(fromOption), &from) || !parseView(parser.value(toOption), &to))
+        {
+            qCritical() << "The animation needs --from and --to as x,y,scale";
+            return 1;
+        }
+        QSize size(1920, 1080);
+        if(parser.isSet(frameSizeOption))
+        {
+            const QStringList values = parser.value(frameSizeOption).split(QLatin1Char('x'));
+            if(values.size() == 2 && values.at(0).toInt() > 0 && values.at(1).toInt() > 0)
+            {
+                size = QSize(values.at(0).toInt(), values.at(1).toInt());
+            }
+        }
+
+        ZoomAnimation animation;
+        if(parser.isSet(threadsOption))
+        {
+            animation.setThreadCount(parser.value(threadsOption).toInt());
+        }
+        animation.setInstructionSet(instructionSet);
+        if(parser.isSet(frameFormatOption))
+        {
+            animation.setImageFormat(parser.value(frameFormatOption));
+        }
+        animation.setFrameReuse(!parser.isSet(noFrameReuseOption));
+        Palette palette;
+        palette.setSmooth(parser.isSet(smoothOption));
+        animation.setPalette(palette);
+        //Iterations of the last pass of the interactive view
+        animation.setMaxIterations(RenderThread::passIterations(RenderThread::PassCount - 1));
+
+        int result = 0;
+        QObject::connect(&animation, &ZoomAnimation::progress, [](int written, int frames)
+        {
+            qInfo().nospace() << "Frame " << written << " of " << frames << " written";
+        });
+        QObject::connect(&animation, &ZoomAnimation::animationWritten, &app, &QCoreApplication::quit);
+        QObject::connect(&animation, &ZoomAnimation::animationFailed, [&result](const QString& directory,
+                                                                               const QString& error)
+        {
+            qCritical().nospace() << "Animation " << directory << " failed: " << error;
+            result = 1;
+            QCoreApplication::quit();
+        });
+        const int frames = parser.isSet(framesOption) ? parser.value(framesOption).toInt() : 300;
+        if(!animation.renderAnimation(parser.value(animateOption), from, to, frames, size))
+        {
+            qCritical() << "Invalid animation";
+            return 1;
+        }
+        app.exec();
+
+        const ZoomAnimation::Stats stats = animation.stats();
+        qInfo().nospace() << "Frames: " << stats.frames
+                          << " in " << stats.nsecs / 1000000.0 << " ms"
+                          << ", computed pixels: " << stats.computedPixels
+                          << ", reused: " << stats.reusedPixels
+                          << " of " << stats.pixels
+                          << ", compute stalled: " << stats.stallNsecs / 1000000.0 << " ms";
+        return result;
+    }
+
     MandlebrotWidget widget;
+    if(parser.isSet(threadsOption))
+    {
+        widget.setThreadCount(parser.value(threadsOption).toInt());
+    }
+    if(parser.isSet(kernelOption))
+    {
+        widget.setInstructionSet(instructionSet);
+    }
+    if(parser.isSet(interiorOption))
+    {
+        const QString checks = parser.value(interiorOption);
+        int interiorChecks = EscapeKernel::NoInteriorChecks;
+        if(checks == QLatin1String("all") || checks == QLatin1String("cardioid"))
+        {
+            interiorChecks |= EscapeKernel::CardioidCheck;
+        }
+        if(checks == QLatin1String("all") || checks == QLatin1String("periodicity"))
+        {
+            interiorChecks |= EscapeKernel::PeriodicityCheck;
+        }
+        widget.setInteriorChecks(interiorChecks);
+    }
+    widget.setFractal(fractal);
+    if(parser.isSet(subdivideOption))
+    {
+        const QString passes = parser.value(subdivideOption);
+        widget.setSubdivisionMode(passes == QLatin1String("previews") ? RenderThread::SubdividePreviews :
+                                  passes == QLatin1String("all") ? RenderThread::SubdivideAllPasses :
+                                                                   RenderThread::NoSubdivision);
+    }
+    if(parser.isSet(deepZoomOption))
+    {
+        const QString mode = parser.value(deepZoomOption);
+        widget.setPerturbationMode(mode == QLatin1String("on") ? RenderThread::PerturbationOn :
+                                   mode == QLatin1String("off") ? RenderThread::PerturbationOff :
+                                                                  RenderThread::PerturbationAuto);
+    }
+    if(parser.isSet(cacheOption))
+    {
+        widget.setTileCacheSize(qint64(parser.value(cacheOption).toInt()) * 1024 * 1024);
+    }
+    const qint64 diskCacheBytes = qint64(parser.isSet(diskCacheOption) ? parser.value(diskCacheOption).toInt() : 256)
+            * 1024 * 1024;
+    if(diskCacheBytes > 0)
+    {
+        //Runs without the file are only slower to start
+        const QString directory = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+        QString error;
+        if(!QDir().mkpath(directory) ||
+                !widget.setTileStore(QDir(directory).filePath(QStringLiteral("tiles.cache")), diskCacheBytes, &error))
+        {
+            qWarning().nospace() << "No tile cache on disk in " << directory << ": " << error;
+        }
+    }
+    if(parser.isSet(previewOption))
+    {
+        widget.setPreviewBudget(parser.value(previewOption).toInt());
+    }
+    if(parser.isSet(speculateOption))
+    {
+        widget.setSpeculativeLevels(parser.value(speculateOption).toInt());
+    }
+    if(parser.isSet(antialiasOption))
+    {
+        widget.setAntialiasing(parser.value(antialiasOption).toInt());
+    }
+    if(parser.isSet(bandsOption))
+    {
+        widget.setDeliveryMode(RenderThread::BandDelivery, parser.value(bandsOption).toInt());
+    }
+    widget.setExportSize(exportSize);
+    widget.setExportWorkers(workers);
+    widget.setSmoothColoring(parser.isSet(smoothOption));
+    widget.setColorCycling(parser.isSet(cycleOption));
+    widget.setOverlayVisible(parser.isSet(overlayOption));
     widget.show();
-    return app.exec();
+    const int result = app.exec();
+
+    if(parser.isSet(statsOption))
+    {
+        const MandlebrotWidget::Stats stats = widget.stats();
+        qInfo().nospace() << "Frames delivered: " << stats.framesDelivered
+                          << ", regions delivered: " << stats.regionsDelivered
+                          << ", frame buffers reused: " << stats.frameBuffers.reused
+                          << ", allocated: " << stats.frameBuffers.allocated
+                          << ", paints: " << stats.paints
+                          << " (" << stats.paintNsecs / 1000000.0 << " ms)"
+                          << ", GUI time: " << stats.guiNsecs / 1000000.0 << " ms";
+        qInfo().nospace() << "Requests: " << stats.requests.requests
+                          << ", coalesced: " << stats.requests.coalesced
+                          << ", cancel latency: "
+                          << (stats.requests.cancelled > 0 ?
+                                  stats.requests.cancelNsecs / stats.requests.cancelled : 0) / 1000000.0
+                          << " ms, max " << stats.requests.maxCancelNsecs / 1000000.0 << " ms";
+        qInfo().nospace() << "Restarts: " << stats.restarts
+                          << ", last first frame latency: " << stats.firstFrameNsecs / 1000000.0 << " ms";
+        const TileCache::Stats cacheStats = widget.tileCacheStats();
+        qInfo().nospace() << "Tile cache hits: " << cacheStats.hits
+                          << ", misses: " << cacheStats.misses
+                          << ", evictions: " << cacheStats.evictions
+                          << ", tiles: " << cacheStats.tiles
+                          << " (" << cacheStats.bytes / 1024 << " KiB)"
+                          << ", from disk: " << cacheStats.diskHits
+                          << " (" << cacheStats.diskBytes / 1024 / 1024 << " MiB file)";
+        qInfo().nospace() << "Rendered ahead: " << stats.speculation.views
+                          << ", hits: " << stats.speculation.hits
+                          << ", misses: " << stats.speculation.misses;
+        qInfo().nospace() << "Anti-aliased pixels: " << stats.antialiasing.edgePixels
+                          << " of " << stats.antialiasing.pixels
+                          << ", samples: " << stats.antialiasing.samples
+                          << " (" << stats.antialiasing.nsecs / 1000000.0 << " ms)";
+    }
+    return result;
 }
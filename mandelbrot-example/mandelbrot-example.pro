@@ -1,10 +1,10 @@
+include(rendercore.pri)
+
 HEADERS += \
-    mandlebrotwidget.h \
-    renderthread.h
+    mandlebrotwidget.h
 
 SOURCES += \
     main.cpp \
-    mandlebrotwidget.cpp \
-    renderthread.cpp
+    mandlebrotwidget.cpp
 
 QT += widgets
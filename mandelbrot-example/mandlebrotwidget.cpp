@@ -2,15 +2,25 @@
 
 #include <QPainter>
 #include <QKeyEvent>
+#include <QElapsedTimer>
+#include <QScreen>
+#include <QFileDialog>
+#include <QDebug>
 #include <cmath>
+#include <algorithm>
+#include <iterator>
 
 const double DefaultCenterX = -0.637011;
 const double DefaultCenterY = -0.0395159;
 const double DefaultScale = 0.00403897;
+//Pixel deltas of deep zoom are doubles, keep their squares out of the denormal range
+const double MinimumScale = 1e-150;
 
 const double ZoomInFactor = 0.8;
 const double ZoomOutFactor = 1 / ZoomInFactor;
 const int ScrollStep = 20;
+//Palette entries per second of the color cycling
+const double CycleSpeed = 30;
 
 MandlebrotWidget::MandlebrotWidget(QWidget *parent) : QWidget(parent),
     centerX(DefaultCenterX),
@@ -20,6 +30,13 @@ MandlebrotWidget::MandlebrotWidget(QWidget *parent) : QWidget(parent),
 {
 
     connect(&thread, &RenderThread::renderedImage, this, &MandlebrotWidget::updatePixmap);
+    connect(&thread, &RenderThread::renderedRegion, this, &MandlebrotWidget::updateRegion);
+    connect(&thread, &RenderThread::passFinished, this, &MandlebrotWidget::updatePassStats);
+    connect(&colorCycle, &QTimer::timeout, this, &MandlebrotWidget::cycleColors);
+    connect(&exporter, &ImageExporter::progress, this, &MandlebrotWidget::updateExportProgress);
+    connect(&exporter, &ImageExporter::exported, this, &MandlebrotWidget::finishExport);
+    connect(&exporter, &ImageExporter::exportFailed, this, &MandlebrotWidget::failExport);
+    restartWindow.start();
     setWindowTitle("Mandelbrot");
 #if QT_CONFIG(cursor)
     setCursor(Qt::CrossCursor);
@@ -27,29 +44,153 @@ MandlebrotWidget::MandlebrotWidget(QWidget *parent) : QWidget(parent),
     resize(550, 400);
 }
 
+void MandlebrotWidget::setThreadCount(int threadCount)
+{
+    thread.setThreadCount(threadCount);
+    exporter.setThreadCount(threadCount);
+}
+
+void MandlebrotWidget::setInstructionSet(EscapeKernel::InstructionSet instructionSet)
+{
+    thread.setInstructionSet(instructionSet);
+    exporter.setInstructionSet(instructionSet);
+}
+
+void MandlebrotWidget::setInteriorChecks(int interiorChecks)
+{
+    thread.setInteriorChecks(interiorChecks);
+    exporter.setInteriorChecks(interiorChecks);
+}
+
+void MandlebrotWidget::setFractal(const EscapeKernel::Fractal &fractal)
+{
+    this->fractal = fractal;
+    thread.setFractal(fractal);
+    exporter.setFractal(fractal);
+    if(isVisible())
+    {
+        thread.render(centerX, centerY, curScale, size(), devicePixelRatioF());
+    }
+}
+
+void MandlebrotWidget::setSubdivisionMode(RenderThread::SubdivisionMode mode)
+{
+    thread.setSubdivisionMode(mode);
+}
+
+void MandlebrotWidget::setPreviewBudget(int msecs)
+{
+    thread.setPreviewBudget(msecs);
+}
+
+void MandlebrotWidget::setSpeculativeLevels(int levels)
+{
+    thread.setSpeculativeLevels(levels);
+}
+
+void MandlebrotWidget::setAntialiasing(int gridSize)
+{
+    thread.setAntialiasing(gridSize);
+}
+
+void MandlebrotWidget::setSmoothColoring(bool smooth)
+{
+    smoothColoring = smooth;
+    thread.setSmoothColoring(smooth);
+}
+
+void MandlebrotWidget::setColorCycling(bool cycling)
+{
+    if(!cycling)
+    {
+        colorCycle.stop();
+        return;
+    }
+
+    //Every tick only colors the last image again
+    colorCycleTimer.start();
+    const qreal refreshRate = screen() ? screen()->refreshRate() : 60;
+    colorCycle.start(int(1000 / qMax(refreshRate, qreal(1))));
+}
+
+void MandlebrotWidget::setExportSize(QSize size)
+{
+    exportSize = size;
+}
+
+void MandlebrotWidget::setExportWorkers(const QStringList &addresses)
+{
+    exporter.setWorkers(addresses);
+}
+
+void MandlebrotWidget::setPerturbationMode(RenderThread::PerturbationMode mode)
+{
+    thread.setPerturbationMode(mode);
+}
+
+void MandlebrotWidget::setDeliveryMode(RenderThread::DeliveryMode mode, int bandHeight)
+{
+    thread.setDeliveryMode(mode, bandHeight);
+}
+
+MandlebrotWidget::Stats MandlebrotWidget::stats() const
+{
+    Stats result = renderStats;
+    result.restarts = thread.restartCount();
+    result.frameBuffers = thread.frameBufferStats();
+    result.requests = thread.requestStats();
+    result.speculation = thread.speculationStats();
+    result.antialiasing = thread.antialiasStats();
+    return result;
+}
+
+void MandlebrotWidget::setOverlayVisible(bool visible)
+{
+    overlayVisible = visible;
+    update();
+}
+
+void MandlebrotWidget::setTileCacheSize(qint64 bytes)
+{
+    thread.setTileCacheSize(bytes);
+}
+
+bool MandlebrotWidget::setTileStore(const QString &fileName, qint64 maxBytes, QString *error)
+{
+    return thread.setTileStore(fileName, maxBytes, error);
+}
+
+TileCache::Stats MandlebrotWidget::tileCacheStats() const
+{
+    return thread.tileCacheStats();
+}
+
 void MandlebrotWidget::paintEvent(QPaintEvent *event)
 {
+    QElapsedTimer timer;
+    timer.start();
+
     QPainter painter(this);
     painter.fillRect(rect(), Qt::black);
 
-    if(pixmap.isNull())
+    if(frame.isNull())
     {
         painter.setPen(Qt::white);
         painter.drawText(rect(), Qt::AlignCenter, tr("Rendering initial image, please wait..."));
-        return;
     }
-
-    if(qFuzzyCompare(curScale, pixmapScale))
+    else if(qFuzzyCompare(curScale, pixmapScale))
     {
-        painter.drawPixmap(rect(), pixmap);
+        //Images of the render thread are drawn as they are, a conversion to
+        //a pixmap would copy every frame once more
+        painter.drawImage(rect(), frame);
     }
     else
     {
         //Draw preview pixmap, if it's not ready
-        auto previewPixmap = qFuzzyCompare(pixmap.devicePixelRatio(), qreal(1))?
-                    pixmap :
-                    pixmap.scaled(pixmap.size() / pixmap.devicePixelRatioF(), Qt::KeepAspectRatio,
-                                  Qt::SmoothTransformation);
+        auto previewPixmap = qFuzzyCompare(frame.devicePixelRatio(), qreal(1))?
+                    frame :
+                    frame.scaled(frame.size() / frame.devicePixelRatioF(), Qt::KeepAspectRatio,
+                                 Qt::SmoothTransformation);
 
         double scaleFactor = pixmapScale / curScale;
         int newWidth = int(previewPixmap.width() * scaleFactor);
@@ -62,7 +203,7 @@ void MandlebrotWidget::paintEvent(QPaintEvent *event)
         painter.scale(scaleFactor, scaleFactor);
 
         QRectF exposed = painter.transform().inverted().mapRect(rect()).adjusted(-1, -1, 1, 1);
-        painter.drawPixmap(exposed, previewPixmap, exposed);
+        painter.drawImage(exposed, previewPixmap, exposed);
         painter.restore();
 
         QString text = tr("Use mouse wheel or the '+' and '-' keys to zoom. "
@@ -76,6 +217,16 @@ void MandlebrotWidget::paintEvent(QPaintEvent *event)
         painter.setPen(Qt::white);
         painter.drawText((width() - textWidth) / 2, metrics.leading() + metrics.ascent(), text);
     }
+
+    if(overlayVisible)
+    {
+        drawOverlay(painter);
+    }
+
+    ++renderStats.paints;
+    renderStats.lastPaintNsecs = timer.nsecsElapsed();
+    renderStats.paintNsecs += renderStats.lastPaintNsecs;
+    renderStats.guiNsecs += renderStats.lastPaintNsecs;
 }
 
 #if QT_CONFIG(wheelevent)
@@ -93,6 +244,9 @@ void MandlebrotWidget::wheelEvent(QWheelEvent *event)
 
 void MandlebrotWidget::resizeEvent(QResizeEvent *event)
 {
+    //Bands are not delivered faster than the display can show them
+    const qreal refreshRate = screen() ? screen()->refreshRate() : 60;
+    thread.setFrameInterval(int(1000 / qMax(refreshRate, qreal(1))));
     thread.render(centerX, centerY, curScale, size(), devicePixelRatioF());
 }
 
@@ -118,6 +272,28 @@ void MandlebrotWidget::keyPressEvent(QKeyEvent *event)
     case Qt::Key_Down:
         scroll(0, +ScrollStep);
         break;
+    case Qt::Key_I:
+        setOverlayVisible(!overlayVisible);
+        break;
+    case Qt::Key_S:
+        setSmoothColoring(!smoothColoring);
+        break;
+    case Qt::Key_C:
+        setColorCycling(!colorCycle.isActive());
+        break;
+    case Qt::Key_E:
+        exportView();
+        break;
+    case Qt::Key_F:
+    {
+        EscapeKernel::Fractal next = fractal;
+        next.formula = EscapeKernel::Formula((fractal.formula + 1) % (EscapeKernel::Multibrot3 + 1));
+        setFractal(next);
+        break;
+    }
+    case Qt::Key_Escape:
+        exporter.cancel();
+        break;
     default:
         QWidget::keyPressEvent(event);
         break;
@@ -150,7 +326,7 @@ void MandlebrotWidget::mouseReleaseEvent(QMouseEvent *event)
         pixmapOffset += event->pos() - lastDragPos;
         lastDragPos = QPoint();
 
-        const auto pixmapSize = pixmap.size() / pixmap.devicePixelRatioF();
+        const auto pixmapSize = frame.size() / frame.devicePixelRatioF();
         int deltaX = (width() - pixmapSize.width()) / 2 - pixmapOffset.x();
         int deltaY = (height() - pixmapSize.height()) / 2 - pixmapOffset.y();
         scroll(deltaX, deltaY);
@@ -162,24 +338,206 @@ void MandlebrotWidget::updatePixmap(const QImage &image, double scaleFactor)
     if (!lastDragPos.isNull())
             return;
 
-        pixmap = QPixmap::fromImage(image);
+        QElapsedTimer timer;
+        timer.start();
+
+        //Buffer of the image before goes back to the render thread
+        frame = image;
         pixmapOffset = QPoint();
         lastDragPos = QPoint();
         pixmapScale = scaleFactor;
         update();
+
+        ++renderStats.framesDelivered;
+        renderStats.guiNsecs += timer.nsecsElapsed();
+}
+
+void MandlebrotWidget::updateRegion(const QImage &image, const QRect &region, double scaleFactor)
+{
+    if (!lastDragPos.isNull() || !qFuzzyCompare(scaleFactor, pixmapScale))
+    {
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    if (frame.isNull() || frame.size() != image.size())
+    {
+        return;
+    }
+
+    //Finished part of the pass goes straight into the buffer the widget
+    //holds. Region is in device pixels, so paint without the pixel ratio,
+    //the image of the pass is only read as the rest of it is still drawn.
+    const qreal pixelRatio = frame.devicePixelRatioF();
+    frame.setDevicePixelRatio(1);
+    QPainter painter(&frame);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    painter.drawImage(QRectF(region), image, QRectF(region));
+    painter.end();
+    frame.setDevicePixelRatio(pixelRatio);
+    update();
+
+    ++renderStats.regionsDelivered;
+    renderStats.regionNsecs += timer.nsecsElapsed();
+    renderStats.guiNsecs += timer.nsecsElapsed();
+}
+
+void MandlebrotWidget::cycleColors()
+{
+    paletteOffset += colorCycleTimer.restart() * CycleSpeed / 1000;
+    paletteOffset = std::fmod(paletteOffset, double(Palette::Size));
+    thread.setPaletteOffset(paletteOffset);
+}
+
+void MandlebrotWidget::exportView()
+{
+    if(exporter.isRunning())
+    {
+        return;
+    }
+
+    const QString fileName = QFileDialog::getSaveFileName(this, tr("Export View"), QString(),
+                                                          tr("TIFF Images (*.tif *.tiff)"));
+    if(fileName.isEmpty())
+    {
+        return;
+    }
+
+    //Export covers the width of the view with the colors of the screen and
+    //the iterations of the last pass
+    Palette palette;
+    palette.setSmooth(smoothColoring);
+    palette.setOffset(paletteOffset);
+    exporter.setPalette(palette);
+    exporter.setMaxIterations(RenderThread::passIterations(RenderThread::PassCount - 1));
+    exporter.exportImage(fileName, centerX, centerY, curScale * width() / exportSize.width(), exportSize);
+}
+
+void MandlebrotWidget::updateExportProgress(int finishedRows, int rows)
+{
+    setWindowTitle(tr("Mandelbrot - exporting %1%").arg(finishedRows * 100 / rows));
+}
+
+void MandlebrotWidget::finishExport(const QString &fileName)
+{
+    setWindowTitle(tr("Mandelbrot"));
+    qInfo() << "Exported" << fileName;
+}
+
+void MandlebrotWidget::failExport(const QString &fileName, const QString &error)
+{
+    setWindowTitle(tr("Mandelbrot"));
+    qWarning() << "Export of" << fileName << "failed:" << error;
+}
+
+void MandlebrotWidget::updatePassStats(const RenderThread::PassStats &passStats)
+{
+    //Every view starts with pass 0
+    if(passStats.pass == 0)
+    {
+        std::fill(std::begin(renderStats.passNsecs), std::end(renderStats.passNsecs), 0);
+    }
+    renderStats.lastPass = passStats;
+    renderStats.passNsecs[passStats.pass] = passStats.nsecs;
+    if(passStats.firstImage)
+    {
+        renderStats.firstFrameNsecs = passStats.sinceRequestNsecs;
+    }
+
+    sampleRestarts();
+    if(overlayVisible)
+    {
+        update();
+    }
+}
+
+void MandlebrotWidget::sampleRestarts()
+{
+    //Rate over windows of at least a second
+    const qint64 elapsed = restartWindow.elapsed();
+    if(elapsed < 1000)
+    {
+        return;
+    }
+
+    const qint64 restarts = thread.restartCount();
+    renderStats.restartsPerSecond = (restarts - windowRestarts) * 1000.0 / elapsed;
+    windowRestarts = restarts;
+    restartWindow.restart();
+}
+
+void MandlebrotWidget::drawOverlay(QPainter &painter)
+{
+    sampleRestarts();
+
+    const Stats& stats = renderStats;
+    auto msecs = [](qint64 nsecs) { return QString::number(nsecs / 1e6, 'f', 1); };
+    QStringList passTimes;
+    for(qint64 nsecs : stats.passNsecs)
+    {
+        passTimes << msecs(nsecs);
+    }
+    const FrameRing::Stats frameBuffers = thread.frameBufferStats();
+    const RenderThread::SpeculationStats speculation = thread.speculationStats();
+    const qint64 predicted = speculation.hits + speculation.misses;
+    const RenderThread::RequestStats requests = thread.requestStats();
+    const RenderThread::AntialiasStats antialiasing = thread.antialiasStats();
+
+    const QStringList lines = {
+        tr("Formula: %1").arg(QLatin1String(EscapeKernel::name(fractal.formula))),
+        tr("Pass %1 with %2 iterations: %3 ms").arg(stats.lastPass.pass).arg(stats.lastPass.maxIterations)
+                .arg(msecs(stats.lastPass.nsecs)),
+        tr("Passes: %1 ms").arg(passTimes.join(QLatin1Char(' '))),
+        tr("Computed %1 of %2 pixels, %3 M iterations").arg(stats.lastPass.computedPixels)
+                .arg(stats.lastPass.pixels).arg(QString::number(stats.lastPass.iterations / 1e6, 'f', 1)),
+        tr("First frame: %1 ms, restarts: %2 (%3/s)").arg(msecs(stats.firstFrameNsecs))
+                .arg(thread.restartCount()).arg(QString::number(stats.restartsPerSecond, 'f', 1)),
+        tr("Requests: %1, coalesced: %2, cancel latency: %3 ms, max %4 ms").arg(requests.requests)
+                .arg(requests.coalesced)
+                .arg(msecs(requests.cancelled > 0 ? requests.cancelNsecs / requests.cancelled : 0))
+                .arg(msecs(requests.maxCancelNsecs)),
+        tr("Frame buffers reused: %1, allocated: %2, paint: %3 ms").arg(frameBuffers.reused)
+                .arg(frameBuffers.allocated).arg(msecs(stats.lastPaintNsecs)),
+        tr("Rendered ahead: %1 views, %2 hits, %3 misses (%4% hit rate)").arg(speculation.views)
+                .arg(speculation.hits).arg(speculation.misses)
+                .arg(predicted > 0 ? speculation.hits * 100 / predicted : 0),
+        tr("Anti-aliased %1 of %2 pixels, %3 samples: %4 ms").arg(antialiasing.edgePixels)
+                .arg(antialiasing.pixels).arg(antialiasing.samples).arg(msecs(antialiasing.nsecs))
+    };
+
+    const QFontMetrics metrics = painter.fontMetrics();
+    int textWidth = 0;
+    for(const QString& line : lines)
+    {
+        textWidth = qMax(textWidth, metrics.horizontalAdvance(line));
+    }
+    const int textHeight = lines.size() * metrics.lineSpacing();
+    const int top = height() - textHeight - 10;
+
+    painter.setPen(Qt::NoPen);
+    painter.setBrush(QColor(0, 0, 0, 127));
+    painter.drawRect(0, top, textWidth + 10, textHeight + 10);
+    painter.setPen(Qt::white);
+    for(int i = 0; i < lines.size(); ++i)
+    {
+        painter.drawText(5, top + 5 + metrics.ascent() + i * metrics.lineSpacing(), lines.at(i));
+    }
 }
 
 void MandlebrotWidget::zoom(double zoomFactor)
 {
-    curScale *= zoomFactor;
+    curScale = qMax(curScale * zoomFactor, MinimumScale);
     update();
     thread.render(centerX, centerY, curScale, size(), devicePixelRatioF());
 }
 
 void MandlebrotWidget::scroll(int deltaX, int deltaY)
 {
-    centerX += deltaX * curScale;
-    centerY += deltaY * curScale;
+    //Center keeps every bit of the steps, so it stays exact at any zoom depth
+    centerX += FixedPoint(deltaX * curScale);
+    centerY += FixedPoint(deltaY * curScale);
     update();
     thread.render(centerX, centerY, curScale, size(), devicePixelRatioF());
 }
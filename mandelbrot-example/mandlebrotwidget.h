@@ -2,15 +2,76 @@
 #define MANDLEBROTWIDGET_H
 
 #include <QWidget>
+#include <QElapsedTimer>
+#include <QTimer>
 
+#include "imageexporter.h"
 #include "renderthread.h"
 
+class QPainter;
+
 class MandlebrotWidget : public QWidget
 {
     Q_OBJECT
 public:
+    //Instrumentation of the whole pipeline, from the passes of the render
+    //thread to the time the GUI thread spends on the frames it delivers
+    struct Stats
+    {
+        RenderThread::PassStats lastPass;
+        //Compute time of the passes of the current view, zero for the ones
+        //not finished or skipped
+        qint64 passNsecs[RenderThread::PassCount] = {};
+        //From the render() call to the first image of the last view
+        qint64 firstFrameNsecs = 0;
+        qint64 restarts = 0;
+        double restartsPerSecond = 0;
+        RenderThread::RequestStats requests;
+        RenderThread::SpeculationStats speculation;
+        RenderThread::AntialiasStats antialiasing;
+
+        int framesDelivered = 0;
+        int regionsDelivered = 0;
+        //Images of the render thread are drawn without converting them
+        FrameRing::Stats frameBuffers;
+        int paints = 0;
+        qint64 regionNsecs = 0;
+        qint64 paintNsecs = 0;
+        qint64 lastPaintNsecs = 0;
+        //All of the above which is spent in the GUI thread
+        qint64 guiNsecs = 0;
+    };
+
     explicit MandlebrotWidget(QWidget *parent = nullptr);
 
+    void setThreadCount(int threadCount);
+    void setInstructionSet(EscapeKernel::InstructionSet instructionSet);
+    void setInteriorChecks(int interiorChecks);
+    //The 'F' key switches to the next formula, keeping the Julia constant
+    void setFractal(const EscapeKernel::Fractal& fractal);
+    void setSubdivisionMode(RenderThread::SubdivisionMode mode);
+    void setPerturbationMode(RenderThread::PerturbationMode mode);
+    void setPreviewBudget(int msecs);
+    //Zoom levels rendered ahead of the wheel, zero disables it
+    void setSpeculativeLevels(int levels);
+    //Samples per axis of the pixels on edges, see RenderThread::setAntialiasing
+    void setAntialiasing(int gridSize);
+    //The 'S' key toggles smooth coloring, 'C' the color cycling
+    void setSmoothColoring(bool smooth);
+    void setColorCycling(bool cycling);
+    //Size of the TIFF the 'E' key exports the view to, Escape cancels it
+    void setExportSize(QSize size);
+    //Exports on mandelbrot-worker processes, see ImageExporter::setWorkers
+    void setExportWorkers(const QStringList& addresses);
+    void setDeliveryMode(RenderThread::DeliveryMode mode, int bandHeight);
+    Stats stats() const;
+    //Shows the stats on top of the image, the 'I' key toggles it as well
+    void setOverlayVisible(bool visible);
+    void setTileCacheSize(qint64 bytes);
+    //Tiles kept across runs, so the first view shows up right away
+    bool setTileStore(const QString& fileName, qint64 maxBytes, QString* error);
+    TileCache::Stats tileCacheStats() const;
+
 protected:
     void paintEvent(QPaintEvent *event) override;
     void resizeEvent(QResizeEvent *event) override;
@@ -24,18 +85,39 @@ protected:
 
 private slots:
     void updatePixmap(const QImage& image, double scaleFactor);
+    void updateRegion(const QImage& image, const QRect& region, double scaleFactor);
+    void updatePassStats(const RenderThread::PassStats& passStats);
     void zoom(double zoomFactor);
+    void cycleColors();
+    void exportView();
+    void updateExportProgress(int finishedRows, int rows);
+    void finishExport(const QString& fileName);
+    void failExport(const QString& fileName, const QString& error);
 
 private:
     void scroll(int deltaX, int deltaY);
+    void sampleRestarts();
+    void drawOverlay(QPainter& painter);
 
 private:
     RenderThread thread;
-    QPixmap pixmap;
+    ImageExporter exporter;
+    QSize exportSize = QSize(8192, 8192);
+    //Buffer of the render thread, held until the next image arrives
+    QImage frame;
+    Stats renderStats;
+    QElapsedTimer restartWindow;
+    qint64 windowRestarts = 0;
+    EscapeKernel::Fractal fractal;
+    bool overlayVisible = false;
+    bool smoothColoring = false;
+    QTimer colorCycle;
+    QElapsedTimer colorCycleTimer;
+    double paletteOffset = 0;
     QPoint pixmapOffset;
     QPoint lastDragPos;
-    double centerX;
-    double centerY;
+    FixedPoint centerX;
+    FixedPoint centerY;
     double pixmapScale;
     double curScale;
 };
@@ -0,0 +1,216 @@
+#include "palette.h"
+
+#include "escapekernel.h"
+
+#include <QColor>
+#include <cmath>
+
+//Same runtime dispatch as the escape time kernels, see escapekernel_simd.cpp
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define PALETTE_X86
+#include <immintrin.h>
+#endif
+
+#if defined(PALETTE_X86) && (defined(__GNUC__) || defined(__clang__))
+#define PALETTE_TARGET(features) __attribute__((target(features)))
+#else
+#define PALETTE_TARGET(features)
+#endif
+
+namespace
+{
+const uint Black = 0xff000000;
+const uint AlphaMask = 0xff000000;
+
+//Weight is in 1/256, red and blue are blended in one multiplication
+inline uint blend(uint a, uint b, uint weight)
+{
+    const uint redBlue = ((((a & 0xff00ff) * (256 - weight)) + ((b & 0xff00ff) * weight)) >> 8) & 0xff00ff;
+    const uint green = ((((a & 0xff00) * (256 - weight)) + ((b & 0xff00) * weight)) >> 8) & 0xff00;
+    return AlphaMask | redBlue | green;
+}
+
+void colorizeScalar(const uint* colors, uint shift, bool smooth, const int* iterations, const quint8* fractions,
+                    int count, int maxIterations, uint* pixels)
+{
+    for(int k = 0; k < count; ++k)
+    {
+        if(iterations[k] >= maxIterations)
+        {
+            pixels[k] = Black;
+            continue;
+        }
+
+        const uint position = (uint(iterations[k]) << 8) + (smooth ? fractions[k] : 0) + shift;
+        const uint index = (position >> 8) & (Palette::Size - 1);
+        pixels[k] = blend(colors[index], colors[(index + 1) & (Palette::Size - 1)], position & 0xff);
+    }
+}
+
+#ifdef PALETTE_X86
+//Eight pixels at a time with gathered table lookups, same integer arithmetic
+//as the scalar loop, so both give the same colors
+PALETTE_TARGET("avx2")
+void colorizeAvx2(const uint* colors, uint shift, bool smooth, const int* iterations, const quint8* fractions,
+                  int count, int maxIterations, uint* pixels)
+{
+    const int Lanes = 8;
+    const __m256i vShift = _mm256_set1_epi32(int(shift));
+    const __m256i vMaxIterations = _mm256_set1_epi32(maxIterations);
+    const __m256i vIndexMask = _mm256_set1_epi32(Palette::Size - 1);
+    const __m256i vWeightMask = _mm256_set1_epi32(0xff);
+    const __m256i vOne = _mm256_set1_epi32(1);
+    const __m256i vFull = _mm256_set1_epi32(256);
+    const __m256i vRedBlue = _mm256_set1_epi32(0xff00ff);
+    const __m256i vGreen = _mm256_set1_epi32(0xff00);
+    const __m256i vAlpha = _mm256_set1_epi32(int(AlphaMask));
+    const int* table = reinterpret_cast<const int*>(colors);
+
+    int k = 0;
+    for(; k + Lanes <= count; k += Lanes)
+    {
+        const __m256i counts = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(iterations + k));
+        __m256i position = _mm256_add_epi32(_mm256_slli_epi32(counts, 8), vShift);
+        if(smooth)
+        {
+            const __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(fractions + k));
+            position = _mm256_add_epi32(position, _mm256_cvtepu8_epi32(bytes));
+        }
+
+        const __m256i index = _mm256_and_si256(_mm256_srli_epi32(position, 8), vIndexMask);
+        const __m256i next = _mm256_and_si256(_mm256_add_epi32(index, vOne), vIndexMask);
+        const __m256i weight = _mm256_and_si256(position, vWeightMask);
+        const __m256i inverse = _mm256_sub_epi32(vFull, weight);
+        const __m256i a = _mm256_i32gather_epi32(table, index, 4);
+        const __m256i b = _mm256_i32gather_epi32(table, next, 4);
+
+        const __m256i redBlue = _mm256_and_si256(_mm256_srli_epi32(_mm256_add_epi32(
+                                    _mm256_mullo_epi32(_mm256_and_si256(a, vRedBlue), inverse),
+                                    _mm256_mullo_epi32(_mm256_and_si256(b, vRedBlue), weight)), 8), vRedBlue);
+        const __m256i green = _mm256_and_si256(_mm256_srli_epi32(_mm256_add_epi32(
+                                  _mm256_mullo_epi32(_mm256_and_si256(a, vGreen), inverse),
+                                  _mm256_mullo_epi32(_mm256_and_si256(b, vGreen), weight)), 8), vGreen);
+        const __m256i color = _mm256_or_si256(vAlpha, _mm256_or_si256(redBlue, green));
+
+        //Black is the alpha alone
+        const __m256i colored = _mm256_cmpgt_epi32(vMaxIterations, counts);
+        const __m256i result = _mm256_or_si256(vAlpha, _mm256_and_si256(color, colored));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(pixels + k), result);
+    }
+
+    colorizeScalar(colors, shift, smooth, iterations + k, fractions ? fractions + k : nullptr, count - k,
+                   maxIterations, pixels + k);
+}
+#endif
+}
+
+Palette::Palette()
+{
+    for(int i = 0; i < Size; ++i)
+    {
+        colors[i] = rgbFromWaveLenght(380 + (i*400.0/Size));
+    }
+}
+
+void Palette::setOffset(double offset)
+{
+    const double entries = std::fmod(offset, double(Size));
+    shift = uint(std::lround((entries < 0 ? entries + Size : entries) * 256)) % (Size * 256);
+}
+
+double Palette::offset() const
+{
+    return shift / 256.0;
+}
+
+void Palette::setSmooth(bool smooth)
+{
+    this->smooth = smooth;
+}
+
+bool Palette::isSmooth() const
+{
+    return smooth;
+}
+
+void Palette::colorize(const int *iterations, const quint8 *fractions, int count, int maxIterations,
+                       uint *pixels) const
+{
+#ifdef PALETTE_X86
+    static const bool avx2 = EscapeKernel::isSupported(EscapeKernel::Avx2);
+    if(avx2)
+    {
+        colorizeAvx2(colors, shift, smooth, iterations, fractions, count, maxIterations, pixels);
+        return;
+    }
+#endif
+    colorizeScalar(colors, shift, smooth, iterations, fractions, count, maxIterations, pixels);
+}
+
+quint8 Palette::fraction(float magnitude)
+{
+    //Continuous escape time n + 1 - log2(log2(|z|)), the escape radius of
+    //two leaves the fraction slightly outside of [0, 1) at times
+    const double fraction = 1 - std::log2(0.5 * std::log2(double(magnitude)));
+    return quint8(qBound(0, int(fraction * 256), 255));
+}
+
+double Palette::magnitude(quint8 fraction)
+{
+    //Middle of the fraction step, so fraction() gives the same value back
+    const double value = (fraction + 0.5) / 256;
+    return std::exp2(std::exp2(2 - value));
+}
+
+uint Palette::rgbFromWaveLenght(double wave)
+{
+    double r = 0;
+    double g = 0;
+    double b = 0;
+
+    if (wave >= 380.0 && wave <= 440.0)
+    {
+        r = -1.0 * (wave - 440.0) / (440.0 - 380.0);
+        b = 1.0;
+    }
+    else if (wave >= 440.0 && wave <= 490.0)
+    {
+        g = (wave - 440.0) / (490.0 - 440.0);
+        b = 1.0;
+    }
+    else if (wave >= 490.0 && wave <= 510.0)
+    {
+        g = 1.0;
+        b = -1.0 * (wave - 510.0) / (510.0 - 490.0);
+    }
+    else if (wave >= 510.0 && wave <= 580.0)
+    {
+        r = (wave - 510.0) / (580.0 - 510.0);
+        g = 1.0;
+    }
+    else if (wave >= 580.0 && wave <= 645.0)
+    {
+        r = 1.0;
+        g = -1.0 * (wave - 645.0) / (645.0 - 580.0);
+    }
+    else if (wave >= 645.0 && wave <= 780.0)
+    {
+        r = 1.0;
+    }
+
+    double s = 1.0;
+    if (wave > 700.0)
+    {
+        s = 0.3 + 0.7 * (780.0 - wave) / (780.0 - 700.0);
+    }
+    else if (wave <  420.0)
+    {
+        s = 0.3 + 0.7 * (wave - 380.0) / (420.0 - 380.0);
+    }
+
+    r = std::pow(r * s, 0.8);
+    g = std::pow(g * s, 0.8);
+    b = std::pow(b * s, 0.8);
+
+    return qRgb(int(r * 255), int(g * 255), int(b * 255));
+}
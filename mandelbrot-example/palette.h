@@ -0,0 +1,42 @@
+#ifndef PALETTE_H
+#define PALETTE_H
+
+#include <QtGlobal>
+
+//Colors of the escape times. Counts are looked up in a cyclic table, so an
+//image can be colored again from its iteration counts, with another offset
+//or with smooth coloring, without computing the fractal again.
+class Palette
+{
+public:
+    enum {Size = 512};
+
+    Palette();
+
+    //Shifts the colors along the table, in entries, for color cycling
+    void setOffset(double offset);
+    double offset() const;
+
+    //Blends neighbouring colors by the fractional escape time
+    void setSmooth(bool smooth);
+    bool isSmooth() const;
+
+    //Colors a run of pixels, the ones with maxIterations or more are black.
+    //Fractions are only read by smooth coloring.
+    void colorize(const int* iterations, const quint8* fractions, int count, int maxIterations, uint* pixels) const;
+
+    //Fractional part of the escape time, from |z|^2 at the escape, in 1/256
+    static quint8 fraction(float magnitude);
+    //|z|^2 which gives the fraction, for counts which were not computed
+    static double magnitude(quint8 fraction);
+
+private:
+    static uint rgbFromWaveLenght(double wave);
+
+    uint colors[Size];
+    //Offset in 1/256 of an entry
+    uint shift = 0;
+    bool smooth = false;
+};
+
+#endif // PALETTE_H
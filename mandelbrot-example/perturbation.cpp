@@ -0,0 +1,121 @@
+#include "perturbation.h"
+
+#include "escapekernel.h"
+
+namespace Perturbation
+{
+
+void ReferenceOrbit::reset(const FixedPoint &centerX, const FixedPoint &centerY, int fractionLimbs)
+{
+    cx = centerX.withFractionLimbs(fractionLimbs);
+    cy = centerY.withFractionLimbs(fractionLimbs);
+    zx = FixedPoint(0, fractionLimbs);
+    zy = FixedPoint(0, fractionLimbs);
+    escaped = false;
+    orbitX.clear();
+    orbitY.clear();
+    orbitX.append(0);
+    orbitY.append(0);
+}
+
+bool ReferenceOrbit::extend(int length, const std::function<bool()> &isCancelled)
+{
+    while(orbitX.size() < length && !escaped)
+    {
+        if((orbitX.size() & 1023) == 0 && isCancelled())
+        {
+            return false;
+        }
+
+        const FixedPoint x2 = zx * zx;
+        const FixedPoint y2 = zy * zy;
+        const FixedPoint xy = zx * zy;
+        zx = x2 - y2 + cx;
+        zy = xy + xy + cy;
+
+        const double x = zx.toDouble();
+        const double y = zy.toDouble();
+        orbitX.append(x);
+        orbitY.append(y);
+        escaped = (x * x) + (y * y) > 4;
+    }
+    return true;
+}
+
+int ReferenceOrbit::size() const
+{
+    return orbitX.size();
+}
+
+bool ReferenceOrbit::hasEscaped() const
+{
+    return escaped;
+}
+
+const double *ReferenceOrbit::x() const
+{
+    return orbitX.constData();
+}
+
+const double *ReferenceOrbit::y() const
+{
+    return orbitY.constData();
+}
+
+void row(const ReferenceOrbit &orbit, double scaleFactor, int firstColumn, int row,
+         int count, int maxIterations, int *iterations, float *magnitudes, int *rebases)
+{
+    const double* zx = orbit.x();
+    const double* zy = orbit.y();
+    const int last = orbit.size() - 1;
+    const int limit = EscapeKernel::stepLimit(maxIterations);
+    const double dcy = row * scaleFactor;
+    const int Limit = 4;
+
+    for(int k = 0; k < count; ++k)
+    {
+        const double dcx = (firstColumn + k) * scaleFactor;
+        double dx = 0;
+        double dy = 0;
+        int m = 0;
+        int result = limit;
+
+        //Step s gives z_s, the escape time counts the steps after z_1 = c
+        for(int s = 1; s <= limit + 1; ++s)
+        {
+            const double x = zx[m];
+            const double y = zy[m];
+            const double ndx = 2 * ((x * dx) - (y * dy)) + ((dx * dx) - (dy * dy)) + dcx;
+            const double ndy = 2 * ((x * dy) + (y * dx)) + (2 * dx * dy) + dcy;
+            dx = ndx;
+            dy = ndy;
+            ++m;
+
+            const double px = zx[m] + dx;
+            const double py = zy[m] + dy;
+            const double magnitude = (px * px) + (py * py);
+            if(s >= 2 && magnitude > Limit)
+            {
+                result = s - 1;
+                if(magnitudes)
+                {
+                    magnitudes[k] = float(magnitude);
+                }
+                break;
+            }
+
+            if(magnitude < (dx * dx) + (dy * dy) || m == last)
+            {
+                //Continue with the full value as delta off Z_0 = 0
+                dx = px;
+                dy = py;
+                m = 0;
+                ++*rebases;
+            }
+        }
+
+        iterations[k] = result;
+    }
+}
+
+}
@@ -0,0 +1,53 @@
+#ifndef PERTURBATION_H
+#define PERTURBATION_H
+
+#include <QVector>
+#include <functional>
+
+#include "fixedpoint.h"
+
+namespace Perturbation
+{
+
+//Below this scale factor double precision pixel coordinates start to
+//collapse into blocks, so deep zoom is switched on
+const double DeepZoomScale = 1e-12;
+
+//Orbit of the reference point (the view center) computed with FixedPoint
+//precision and stored as doubles. Z_0 = 0, Z_1 = C, Z_n+1 = Z_n^2 + C.
+class ReferenceOrbit
+{
+public:
+    void reset(const FixedPoint& centerX, const FixedPoint& centerY, int fractionLimbs);
+
+    //Computes the orbit up to the given length, or until it escapes.
+    //Returns false if it was cancelled before.
+    bool extend(int length, const std::function<bool()>& isCancelled);
+
+    int size() const;
+    bool hasEscaped() const;
+    const double* x() const;
+    const double* y() const;
+
+private:
+    FixedPoint cx;
+    FixedPoint cy;
+    FixedPoint zx;
+    FixedPoint zy;
+    bool escaped = false;
+    QVector<double> orbitX;
+    QVector<double> orbitY;
+};
+
+//Escape time of a run of pixels on one scanline, computed as double deltas
+//off the reference orbit. Pixel k of the run is firstColumn + k pixels and
+//row pixels away from the reference point. When the delta grows larger than
+//the pixel orbit itself the precision of the delta is lost (a glitch), so the
+//pixel is rebased onto the start of the reference orbit. Results and the
+//optional magnitudes follow the conventions of EscapeKernel::RowFunction.
+void row(const ReferenceOrbit& orbit, double scaleFactor, int firstColumn, int row,
+         int count, int maxIterations, int* iterations, float* magnitudes, int* rebases);
+
+}
+
+#endif // PERTURBATION_H
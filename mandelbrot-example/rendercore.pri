@@ -0,0 +1,38 @@
+# Render core without the widget, shared by the example, mandelbrot-bench and
+# mandelbrot-worker
+
+INCLUDEPATH += $$PWD
+
+HEADERS += \
+    $$PWD/doubledouble.h \
+    $$PWD/escapekernel.h \
+    $$PWD/fixedpoint.h \
+    $$PWD/framering.h \
+    $$PWD/imageexporter.h \
+    $$PWD/palette.h \
+    $$PWD/perturbation.h \
+    $$PWD/renderthread.h \
+    $$PWD/tilecache.h \
+    $$PWD/tilefarm.h \
+    $$PWD/tilestore.h \
+    $$PWD/zoomanimation.h
+
+SOURCES += \
+    $$PWD/escapekernel.cpp \
+    $$PWD/escapekernel_simd.cpp \
+    $$PWD/fixedpoint.cpp \
+    $$PWD/framering.cpp \
+    $$PWD/imageexporter.cpp \
+    $$PWD/palette.cpp \
+    $$PWD/perturbation.cpp \
+    $$PWD/renderthread.cpp \
+    $$PWD/tilecache.cpp \
+    $$PWD/tilefarm.cpp \
+    $$PWD/tilestore.cpp \
+    $$PWD/zoomanimation.cpp
+
+QT += gui network
+
+# The vectorized and the scalar kernel have to round the same way, so keep
+# the compiler from contracting the scalar loop into fused multiply-adds
+gcc|clang: QMAKE_CXXFLAGS += -ffp-contract=off
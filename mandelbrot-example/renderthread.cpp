@@ -1,37 +1,243 @@
 #include "renderthread.h"
 
+#include "perturbation.h"
+
 #include <QImage>
+#include <QVector>
+#include <QRect>
+#include <QElapsedTimer>
 #include <cmath>
+#include <algorithm>
+
+namespace
+{
+//Edge of the square tiles a pass is split into. Small enough to balance
+//the uneven cost of the escape time algorithm between the workers
+const int TileSize = 32;
+
+//Rectangles with less pixels inside their border are computed, not divided further
+const int MinSubdivisionArea = 16;
+
+//Pixels per kernel call, limits the buffer of the escape magnitudes
+const int MagnitudeChunk = 256;
+
+//Preview resolution range, as divisors of the image size
+const int MinPreviewFactor = 4;
+const int MaxPreviewFactor = 16;
+
+//Passes of a view rendered ahead, the later ones take longer than the user
+//waits between two wheel steps
+const int SpeculativePasses = 4;
+//Views which lie within it are the same, as for the anchors of the tile cache
+const double SpeculativeScaleTolerance = 1e-9;
+
+int floorDivide(int value, int divisor)
+{
+    return value >= 0 ? value / divisor : -((divisor - 1 - value) / divisor);
+}
+
+//Pixels of the anti-aliasing pass handed out at once to a worker
+const int EdgeChunk = 256;
+
+//Longest wait for the next band when bands are not throttled, to notice
+//cancellation
+const int BandPollMsecs = 16;
+
+//Mean color of the samples of an anti-aliased pixel
+uint averageColor(const Palette& palette, int maxIterations, const int* iterations, const quint8* fractions,
+                  int samples, uint* colors)
+{
+    palette.colorize(iterations, fractions, samples, maxIterations, colors);
+    int red = 0;
+    int green = 0;
+    int blue = 0;
+    for(int k = 0; k < samples; ++k)
+    {
+        red += qRed(colors[k]);
+        green += qGreen(colors[k]);
+        blue += qBlue(colors[k]);
+    }
+    return qRgb((red + samples / 2) / samples, (green + samples / 2) / samples, (blue + samples / 2) / samples);
+}
 
-RenderThread::RenderThread(QObject* parent) : QThread(parent)
+//Counts which did not come from the kernel still finish the pixels that escaped,
+//with the magnitude their fraction was taken from
+void keepEscaped(const int* iterations, const quint8* fractions, int count, int stepLimit,
+                 const EscapeKernel::RowState& state)
 {
-    for(int i = 0; i < ColormapSize; ++i)
+    for(int k = 0; k < count; ++k)
     {
-        colormap[i] = rgbFromWaveLenght(380 + (i*400.0/ColormapSize));
+        if(iterations[k] < stepLimit)
+        {
+            state.steps[k] = EscapeKernel::escapedSteps(iterations[k]);
+            state.x[k] = Palette::magnitude(fractions[k]);
+        }
     }
 }
+}
+
+//Work of one worker in a pass, added to the pass statistics when it is done
+struct RenderThread::WorkCounters
+{
+    qint64 computedPixels = 0;
+    qint64 iterations = 0;
+    int rebases = 0;
+};
+
+struct RenderThread::PassContext
+{
+    //Null for views rendered ahead, their passes only fill the tile cache
+    uchar* bits = nullptr;
+    int bytesPerLine = 0;
+    QSize size;
+    double centerX = 0;
+    double centerY = 0;
+    double scaleFactor = 0;
+    int maxIterations = 0;
+    EscapeKernel::Precision precision = EscapeKernel::DoublePrecision;
+    //Float and double kernel, double-double rows take the wide centers
+    EscapeKernel::RowFunction kernel = nullptr;
+    DoubleDouble wideCenterX;
+    DoubleDouble wideCenterY;
+    int interiorChecks = 0;
+    EscapeKernel::Fractal fractal;
+    //Set in deep zoom, pixels are then computed off the reference orbit
+    const Perturbation::ReferenceOrbit* orbit = nullptr;
+    Palette palette;
+    QAtomicInteger<qint64> computedPixels;
+    QAtomicInteger<qint64> iterations;
+    QAtomicInt rebases;
+    //Tiles lie on the grid of the tile cache, rect is the visible part of a tile
+    struct Tile
+    {
+        QRect rect;
+        QPoint index;
+    };
+
+    QVector<Tile> tiles;
+
+    //Where the iteration of the pixels of a tile stopped, so the next pass
+    //continues them instead of starting over. Allocated by the worker which
+    //computes the tile first.
+    struct TileState
+    {
+        QVector<double> x;
+        QVector<double> y;
+        QVector<int> steps;
+
+        //Deep zoom tiles have no state
+        EscapeKernel::RowState row(int offset)
+        {
+            if(steps.isEmpty())
+            {
+                return {nullptr, nullptr, nullptr};
+            }
+            return {x.data() + offset, y.data() + offset, steps.data() + offset};
+        }
+    };
+
+    QVector<TileState> tileStates;
+    TileCache* cache = nullptr;
+    bool cacheTiles = false;
+    int anchor = 0;
+    QPoint offset;
+    QAtomicInt nextTile;
+    QAtomicInt colored;
+
+    //Iteration counts and fractions of the whole image, every pass writes them
+    int* frame = nullptr;
+    quint8* frameFractions = nullptr;
+    //Part of the image the previous frame already has, pixel (x, y) of this
+    //image is (x, y) + shift there. Usable while a pass needs no more
+    //iterations than the previous frame got.
+    QVector<int> previous;
+    QVector<quint8> previousFractions;
+    QRect previousRect;
+    QPoint shift;
+    int previousMax = 0;
+    bool previousExact = true;
+    bool usePrevious = false;
+    //Tiles of the pass are filled in by subdivision
+    bool subdivide = false;
+
+    //Band delivery, bandTiles is zero when the pass is delivered as a whole
+    const QImage* image = nullptr;
+    int bandTiles = 0;
+    int bandCount = 0;
+    QVector<QRect> bandRects;
+    QVector<QAtomicInt> remainingTiles;
+    QVector<int> finishedBands;
+    QMutex bandMutex;
+    QWaitCondition bandFinished;
+};
+
+RenderThread::RenderThread(QObject* parent) : QThread(parent),
+    kernelInstructionSet(EscapeKernel::bestInstructionSet()),
+    frameInterval(16)
+{
+    qRegisterMetaType<RenderThread::PassStats>();
+}
 
 RenderThread::~RenderThread()
 {
     mutex.lock();
-    abort = true;
+    abort.storeRelaxed(1);
     condition.wakeOne();
     mutex.unlock();
 
     wait();
 }
 
-void RenderThread::render(double centerX, double centerY, double scaleFactor, QSize resultSize, double devicePixelRatio)
+void RenderThread::render(const FixedPoint& centerX, const FixedPoint& centerY, double scaleFactor, QSize resultSize, double devicePixelRatio)
 {
 
     //Lock context, fread at the end of the function
     QMutexLocker lock(&mutex);
 
+    //Zooms around the same center predict the next views
+    const bool sameGrid = (centerX - this->centerX).isZero() && (centerY - this->centerY).isZero() &&
+            resultSize == this->resultSize;
+    zoomRatio = sameGrid && scaleFactor != this->scaleFactor ? scaleFactor / this->scaleFactor : 0;
+
+    //Views rendered ahead are used by this request or still lie ahead of it
+    const int hit = findSpeculated(centerX, centerY, scaleFactor, resultSize);
+    requestSpeculated = hit >= 0;
+    if(requestSpeculated)
+    {
+        ++speculation.hits;
+        speculated.removeAt(hit);
+    }
+    for(int i = speculated.size() - 1; i >= 0; --i)
+    {
+        const SpeculativeView& view = speculated.at(i);
+        const bool ahead = zoomRatio < 1 ? view.scaleFactor < scaleFactor : view.scaleFactor > scaleFactor;
+        if(zoomRatio <= 0 || !ahead || !(view.centerX - centerX).isZero() || !(view.centerY - centerY).isZero() ||
+                view.size != resultSize)
+        {
+            ++speculation.misses;
+            speculated.removeAt(i);
+        }
+    }
+
     this->centerX = centerX;
     this->centerY = centerY;
     this->scaleFactor = scaleFactor;
     this->resultSize = resultSize;
     this->devicePixelRatio = devicePixelRatio;
+    requestTimer.start();
+    ++requests.requests;
+
+    //New generation cancels the render in progress, or the view rendered
+    //ahead. Requests which follow before the thread takes this one only
+    //replace the view.
+    const quint64 generation = requestGeneration.loadRelaxed();
+    if((rendering || speculating) && generation == activeGeneration)
+    {
+        ++requests.cancelled;
+        cancelTimer.start();
+        cancelPending = true;
+    }
+    requestGeneration.storeRelaxed(generation + 1);
 
     if(!isRunning())
     {
@@ -40,174 +246,1306 @@ void RenderThread::render(double centerX, double centerY, double scaleFactor, QS
     }
     else
     {
-        //Restart all computation, and wake thread if it's sleeping
-        restart = true;
+        //Wake thread if it's sleeping
         condition.wakeOne();
     }
 }
 
+int RenderThread::passIterations(int pass)
+{
+    return (1 << (2*pass + 6)) + 32;
+}
+
+void RenderThread::setThreadCount(int threadCount)
+{
+    pool.setMaxThreadCount(qMax(1, threadCount));
+}
+
+int RenderThread::threadCount() const
+{
+    return pool.maxThreadCount();
+}
+
+void RenderThread::setInstructionSet(EscapeKernel::InstructionSet instructionSet)
+{
+    QMutexLocker lock(&mutex);
+    kernelInstructionSet = EscapeKernel::isSupported(instructionSet) ?
+                instructionSet : EscapeKernel::bestInstructionSet();
+}
+
+EscapeKernel::InstructionSet RenderThread::instructionSet() const
+{
+    QMutexLocker lock(&mutex);
+    return kernelInstructionSet;
+}
+
+void RenderThread::setInteriorChecks(int interiorChecks)
+{
+    QMutexLocker lock(&mutex);
+    kernelInteriorChecks = interiorChecks;
+}
+
+int RenderThread::interiorChecks() const
+{
+    QMutexLocker lock(&mutex);
+    return kernelInteriorChecks;
+}
+
+void RenderThread::setFractal(const EscapeKernel::Fractal& fractal)
+{
+    QMutexLocker lock(&mutex);
+    if(fractal != kernelFractal)
+    {
+        //Views rendered ahead show the other formula
+        speculation.misses += speculated.size();
+        speculated.clear();
+    }
+    kernelFractal = fractal;
+}
+
+EscapeKernel::Fractal RenderThread::fractal() const
+{
+    QMutexLocker lock(&mutex);
+    return kernelFractal;
+}
+
+void RenderThread::setSubdivisionMode(SubdivisionMode mode)
+{
+    QMutexLocker lock(&mutex);
+    subdivision = mode;
+}
+
+RenderThread::SubdivisionMode RenderThread::subdivisionMode() const
+{
+    QMutexLocker lock(&mutex);
+    return subdivision;
+}
+
+void RenderThread::setPerturbationMode(PerturbationMode mode)
+{
+    QMutexLocker lock(&mutex);
+    perturbation = mode;
+}
+
+RenderThread::PerturbationMode RenderThread::perturbationMode() const
+{
+    QMutexLocker lock(&mutex);
+    return perturbation;
+}
+
+void RenderThread::setTileCacheSize(qint64 bytes)
+{
+    tileCache.setMaxBytes(bytes);
+}
+
+bool RenderThread::setTileStore(const QString &fileName, qint64 maxBytes, QString *error)
+{
+    return tileCache.setStore(fileName, maxBytes, error);
+}
+
+TileCache::Stats RenderThread::tileCacheStats() const
+{
+    return tileCache.stats();
+}
+
+void RenderThread::setDeliveryMode(DeliveryMode mode, int bandHeight)
+{
+    QMutexLocker lock(&mutex);
+    delivery = mode;
+    this->bandHeight = qMax(1, bandHeight);
+}
+
+RenderThread::DeliveryMode RenderThread::deliveryMode() const
+{
+    QMutexLocker lock(&mutex);
+    return delivery;
+}
+
+void RenderThread::setFrameInterval(int msecs)
+{
+    frameInterval.storeRelaxed(qMax(0, msecs));
+}
+
+void RenderThread::setPreviewBudget(int msecs)
+{
+    QMutexLocker lock(&mutex);
+    previewMsecs = qMax(0, msecs);
+}
+
+int RenderThread::previewBudget() const
+{
+    QMutexLocker lock(&mutex);
+    return previewMsecs;
+}
+
+void RenderThread::setPaletteOffset(double offset)
+{
+    QMutexLocker lock(&mutex);
+    palette.setOffset(offset);
+    paletteChanged = true;
+    if(speculating)
+    {
+        preempted.storeRelaxed(1);
+    }
+    condition.wakeOne();
+}
+
+void RenderThread::setSmoothColoring(bool smooth)
+{
+    QMutexLocker lock(&mutex);
+    palette.setSmooth(smooth);
+    paletteChanged = true;
+    if(speculating)
+    {
+        preempted.storeRelaxed(1);
+    }
+    condition.wakeOne();
+}
+
+FrameRing::Stats RenderThread::frameBufferStats() const
+{
+    const FrameRing::Stats images = frames.stats();
+    const FrameRing::Stats previews = previewFrames.stats();
+    FrameRing::Stats result;
+    result.reused = images.reused + previews.reused;
+    result.allocated = images.allocated + previews.allocated;
+    return result;
+}
+
+void RenderThread::setSpeculativeLevels(int levels)
+{
+    QMutexLocker lock(&mutex);
+    speculationLevels = qMax(0, levels);
+}
+
+int RenderThread::speculativeLevels() const
+{
+    QMutexLocker lock(&mutex);
+    return speculationLevels;
+}
+
+RenderThread::SpeculationStats RenderThread::speculationStats() const
+{
+    QMutexLocker lock(&mutex);
+    return speculation;
+}
+
+qint64 RenderThread::restartCount() const
+{
+    QMutexLocker lock(&mutex);
+    return requests.cancelled;
+}
+
+RenderThread::RequestStats RenderThread::requestStats() const
+{
+    QMutexLocker lock(&mutex);
+    return requests;
+}
+
+void RenderThread::setAntialiasing(int gridSize, int threshold)
+{
+    QMutexLocker lock(&mutex);
+    antialiasGrid = gridSize < 2 ? 0 : gridSize | 1;
+    antialiasThreshold = qMax(0, threshold);
+}
+
+int RenderThread::antialiasGridSize() const
+{
+    QMutexLocker lock(&mutex);
+    return antialiasGrid;
+}
+
+RenderThread::AntialiasStats RenderThread::antialiasStats() const
+{
+    QMutexLocker lock(&mutex);
+    return antialiasing;
+}
+
 void RenderThread::run()
 {
     forever
     {
         mutex.lock();
+        //Requests since the last render collapse into the latest one. One
+        //which came in after the thread picked a view to render ahead
+        //replaces that as well.
+        const quint64 generation = requestGeneration.loadRelaxed();
+        //Predicted view only goes into the tile cache, nothing is delivered
+        //and the last frame stays the one of the requested view
+        const bool speculative = speculating && generation == activeGeneration;
+        speculating = speculative;
+        rendering = !speculative;
+        if(!speculative)
+        {
+            preempted.storeRelaxed(0);
+        }
+        if(generation > activeGeneration + 1)
+        {
+            requests.coalesced += qint64(generation - activeGeneration - 1);
+        }
+        activeGeneration = generation;
+        if(cancelPending)
+        {
+            const qint64 latency = cancelTimer.nsecsElapsed();
+            requests.cancelNsecs += latency;
+            requests.maxCancelNsecs = qMax(requests.maxCancelNsecs, latency);
+            cancelPending = false;
+        }
+
+        const QElapsedTimer requested = requestTimer;
         const double devicePixelRatio  = this->devicePixelRatio;
         const QSize resultSize = this->resultSize;
-        const double requestedScaleFactor = this->scaleFactor;
-        const double centerX = this->centerX;
-        const double centerY = this->centerY;
+        const double requestedScaleFactor = speculative ? speculativeScale : this->scaleFactor;
+        const FixedPoint centerX = this->centerX;
+        const FixedPoint centerY = this->centerY;
+        const EscapeKernel::InstructionSet instructionSet = kernelInstructionSet;
+        const int interiorChecks = kernelInteriorChecks;
+        const EscapeKernel::Fractal fractal = kernelFractal;
+        const DeliveryMode delivery = this->delivery;
+        const int bandHeight = this->bandHeight;
+        const SubdivisionMode subdivision = this->subdivision;
+        //Tiles of a view rendered ahead make the first passes quick anyway
+        const int previewBudget = speculative || requestSpeculated ? 0 : previewMsecs;
+        const int numOfPasses = speculative ? speculativePasses(resultSize) : int(PassCount);
+        const int antialiasGrid = speculative ? 0 : this->antialiasGrid;
+        const int antialiasThreshold = this->antialiasThreshold;
+        const Palette palette = this->palette;
+        if(!speculative)
+        {
+            paletteChanged = false;
+        }
+        const bool deepZoom = fractal.formula == EscapeKernel::Mandelbrot && (perturbation == PerturbationOn ||
+                (perturbation == PerturbationAuto && requestedScaleFactor < Perturbation::DeepZoomScale));
         mutex.unlock();
 
-        int halfWidth = resultSize.width() / 2;
-        int halfHeight = resultSize.height() / 2;
-        QImage image(resultSize, QImage::Format_RGB32);
-        image.setDevicePixelRatio(devicePixelRatio);
+        //Drawn by the passes, each into its own buffer of the ring
+        QImage image;
+
+        PassContext context;
+        context.size = resultSize;
+        context.centerX = centerX.toDouble();
+        context.centerY = centerY.toDouble();
+        context.scaleFactor = requestedScaleFactor;
+        //Cheapest numeric type which still resolves the pixels of the view,
+        //the kernel is compiled for each of them. It is the one of the last
+        //pass for all passes, so the tiles of the passes share their keys.
+        context.precision = EscapeKernel::precisionFor(context.centerX, context.centerY, requestedScaleFactor,
+                                                       resultSize.width(), resultSize.height(),
+                                                       passIterations(PassCount - 1));
+        context.kernel = EscapeKernel::rowFunction(instructionSet, context.precision, fractal.formula);
+        if(context.precision == EscapeKernel::DoubleDoublePrecision)
+        {
+            context.wideCenterX = centerX.toDoubleDouble();
+            context.wideCenterY = centerY.toDoubleDouble();
+        }
+        context.interiorChecks = interiorChecks;
+        context.fractal = fractal;
+        context.palette = palette;
+        context.image = &image;
+
+        Perturbation::ReferenceOrbit orbit;
+        if(deepZoom)
+        {
+            //Reference orbit needs the precision of the center and of the pixel steps
+            const int fractionLimbs = qMax(qMax(centerX.fractionLimbs(), centerY.fractionLimbs()),
+                                           FixedPoint::fractionLimbsFor(requestedScaleFactor));
+            orbit.reset(centerX, centerY, fractionLimbs);
+            context.orbit = &orbit;
+        }
+
+        //Split the image into tiles, which are handed out to the workers one by one.
+        //Tiles are laid on the grid of the cache, so views which differ by whole
+        //pixels get the same tiles.
+        context.cache = &tileCache;
+        context.cacheTiles = tileCache.maxBytes() > 0;
+        context.anchor = tileCache.anchor(centerX, centerY, requestedScaleFactor, &context.offset);
+
+        const int halfWidth = resultSize.width() / 2;
+        const int halfHeight = resultSize.height() / 2;
+        const int firstTileX = floorDivide(context.offset.x() - halfWidth, TileSize);
+        const int firstTileY = floorDivide(context.offset.y() - halfHeight, TileSize);
+        const int tilesPerRow = floorDivide(context.offset.x() - halfWidth + resultSize.width() - 1, TileSize) - firstTileX + 1;
+        const int tileRows = floorDivide(context.offset.y() - halfHeight + resultSize.height() - 1, TileSize) - firstTileY + 1;
+        const QRect imageRect(QPoint(0, 0), resultSize);
+        for(int ty = firstTileY; ty < firstTileY + tileRows; ++ty)
+        {
+            for(int tx = firstTileX; tx < firstTileX + tilesPerRow; ++tx)
+            {
+                const QRect rect(tx * TileSize - context.offset.x() + halfWidth,
+                                 ty * TileSize - context.offset.y() + halfHeight, TileSize, TileSize);
+                context.tiles.append({rect & imageRect, QPoint(tx, ty)});
+            }
+        }
+
+        context.tileStates.resize(context.tiles.size());
+
+        //Bands are made of whole rows of tiles
+        const int tileRowsPerBand = (bandHeight + TileSize - 1) / TileSize;
+        const int bandCount = context.tiles.isEmpty() ? 0 : (tileRows + tileRowsPerBand - 1) / tileRowsPerBand;
+        for(int band = 0; band < bandCount; ++band)
+        {
+            const int firstRow = band * tileRowsPerBand;
+            const int lastRow = qMin(firstRow + tileRowsPerBand, tileRows) - 1;
+            context.bandRects.append(context.tiles.at(firstRow * tilesPerRow).rect.united(
+                                         context.tiles.at(lastRow * tilesPerRow + tilesPerRow - 1).rect));
+        }
+
+        //Scrolling keeps scale and grid, only the strips it exposed are new
+        QVector<int> frameIterations(resultSize.width() * resultSize.height());
+        QVector<quint8> frameFractions(frameIterations.size());
+        context.frame = frameIterations.data();
+        context.frameFractions = frameFractions.data();
+        if(lastFrame.maxIterations > 0 && lastFrame.anchor == context.anchor && lastFrame.size == resultSize &&
+                lastFrame.precision == context.precision && lastFrame.perturbation == deepZoom &&
+                lastFrame.fractal == fractal)
+        {
+            context.shift = context.offset - lastFrame.offset;
+            context.previousRect = imageRect & imageRect.translated(-context.shift);
+            context.previous = lastFrame.iterations;
+            context.previousFractions = lastFrame.fractions;
+            context.previousMax = lastFrame.maxIterations;
+            context.previousExact = lastFrame.exact;
+        }
+
+        //New views show a low resolution preview first, a scrolled one has
+        //most of its first pass from the previous frame anyway
+        if(previewBudget > 0 && context.previousRect.isEmpty() &&
+                (!context.orbit || orbit.extend(EscapeKernel::stepLimit(passIterations(0)) + 2,
+                                                [this]() { return isCancelled(); })))
+        {
+            QElapsedTimer previewTimer;
+            previewTimer.start();
+            QImage preview = renderPreview(context, previewFactor);
+            const qint64 elapsed = previewTimer.elapsed();
+            if(!isCancelled())
+            {
+                //Pixel ratio makes the widget draw it at the size of the view
+                preview.setDevicePixelRatio(devicePixelRatio / previewFactor);
+                emit renderedImage(preview, requestedScaleFactor);
+
+                //Each step of the factor changes the pixel count four times
+                if(elapsed > previewBudget && previewFactor < MaxPreviewFactor)
+                {
+                    previewFactor *= 2;
+                }
+                else if(elapsed * 4 < previewBudget / 2 && previewFactor > MinPreviewFactor)
+                {
+                    previewFactor /= 2;
+                }
+            }
+        }
 
-        const int numOfPasses = 8;
         int pass = 0;
+        //Of full resolution, bands can not refine the preview
+        bool imageDelivered = false;
         while(pass < numOfPasses)
         {
-            const int  MaxIterations = (1 << (2*pass + 6)) +32;
-            const int Limit = 4;
-            bool allBlack = true;
+            //Widget holds the image of the pass before until it gets a newer
+            //one, so every pass takes a free buffer instead of detaching it.
+            //Each pass colors every tile, nothing has to be carried over.
+            //Views rendered ahead are never shown and take no buffer.
+            if(!speculative)
+            {
+                image = frames.acquire(resultSize);
+                image.setDevicePixelRatio(devicePixelRatio);
+                context.bits = image.bits();
+                context.bytesPerLine = image.bytesPerLine();
+            }
+            context.maxIterations = passIterations(pass);
+            if(!speculative)
+            {
+                mutex.lock();
+                context.palette = this->palette;
+                paletteChanged = false;
+                mutex.unlock();
+            }
+            QElapsedTimer passTimer;
+            passTimer.start();
+
+            //Orbit grows with the iterations of the pass, one step beyond the
+            //step limit is read by the pixels
+            if(context.orbit && !orbit.extend(EscapeKernel::stepLimit(context.maxIterations) + 2,
+                                              [this]() { return isCancelled(); }))
+            {
+                break;
+            }
+
+            //Bands can only refine an image the widget already has
+            const bool deliverBands = delivery == BandDelivery && imageDelivered;
+            context.bandTiles = deliverBands ? tilesPerRow * tileRowsPerBand : 0;
+            context.bandCount = deliverBands ? bandCount : 0;
+            context.subdivide = subdivision == SubdivideAllPasses ||
+                    (subdivision == SubdividePreviews && pass < numOfPasses - 1);
+            //An exact pass can not take counts which were filled in
+            context.usePrevious = !context.previousRect.isEmpty() && context.maxIterations <= context.previousMax &&
+                    (context.previousExact || context.subdivide);
 
-            for(int i = -halfHeight; i < halfHeight; ++i)
+            if(!renderPass(context))
             {
-                if(restart)
+                break;
+            }
+
+            if(speculative)
+            {
+                pass = context.colored.loadRelaxed() == 0 && pass == 0 ? 4 : pass + 1;
+                continue;
+            }
+
+            lastFrame.iterations = frameIterations;
+            lastFrame.fractions = frameFractions;
+            lastFrame.size = resultSize;
+            lastFrame.scaleFactor = requestedScaleFactor;
+            lastFrame.devicePixelRatio = devicePixelRatio;
+            lastFrame.anchor = context.anchor;
+            lastFrame.precision = context.precision;
+            lastFrame.perturbation = deepZoom;
+            lastFrame.fractal = fractal;
+            lastFrame.offset = context.offset;
+            lastFrame.maxIterations = context.maxIterations;
+            lastFrame.exact = !context.subdivide;
+            lastFrame.edgePixels.clear();
+            lastFrame.edgeIterations.clear();
+            lastFrame.edgeFractions.clear();
+            lastFrame.edgeSamples = 0;
+
+            PassStats stats;
+            stats.pass = pass;
+            stats.maxIterations = context.maxIterations;
+            stats.pixels = qint64(resultSize.width()) * resultSize.height();
+            stats.computedPixels = context.computedPixels.loadRelaxed();
+            stats.iterations = context.iterations.loadRelaxed();
+            stats.rebases = context.rebases.loadRelaxed();
+            stats.nsecs = passTimer.nsecsElapsed();
+            stats.sinceRequestNsecs = requested.nsecsElapsed();
+
+            if (context.colored.loadRelaxed() == 0 && pass == 0)
+            {
+                pass = 4;
+            }
+            else
+            {
+                if(!deliverBands)
                 {
-                    break;
+                    stats.firstImage = !imageDelivered;
+                    emit renderedImage(image, requestedScaleFactor);
+                    imageDelivered = true;
                 }
-                else if(abort)
+                ++pass;
+            }
+            emit passFinished(stats);
+        }
+
+        //Edges are refined once the last pass fixed the iteration counts
+        if(antialiasGrid > 1 && pass >= numOfPasses && imageDelivered && !isCancelled())
+        {
+            antialias(context, centerX, centerY, instructionSet, antialiasGrid, antialiasThreshold);
+        }
+
+        if(abort.loadRelaxed())
+        {
+            return;
+        }
+
+        mutex.lock();
+        rendering = false;
+        if(speculative)
+        {
+            speculating = false;
+            preempted.storeRelaxed(0);
+            if(pass >= numOfPasses)
+            {
+                speculated.append({centerX, centerY, requestedScaleFactor, resultSize});
+                ++speculation.views;
+            }
+        }
+        while(requestGeneration.loadRelaxed() == activeGeneration && !abort.loadRelaxed())
+        {
+            if(paletteChanged)
+            {
+                //New colors for the finished image, the counts stay the same
+                const Palette changed = this->palette;
+                paletteChanged = false;
+                mutex.unlock();
+                recolor(changed);
+                mutex.lock();
+                continue;
+            }
+
+            //Spare time goes to the next views of the zoom, at the low
+            //priority of the workers
+            if(nextSpeculation())
+            {
+                speculating = true;
+                preempted.storeRelaxed(0);
+                break;
+            }
+
+            //If thread should be running, put it in sleep state
+            //in order to save processor time
+            condition.wait(&mutex);
+        }
+        mutex.unlock();
+    }
+}
+
+bool RenderThread::renderPass(PassContext &context)
+{
+    context.nextTile.storeRelaxed(0);
+    context.colored.storeRelaxed(0);
+    context.computedPixels.storeRelaxed(0);
+    context.iterations.storeRelaxed(0);
+    context.rebases.storeRelaxed(0);
+
+    if(context.bandTiles > 0)
+    {
+        context.remainingTiles.fill(QAtomicInt(), context.bandCount);
+        for(int band = 0; band < context.bandCount; ++band)
+        {
+            const int firstTile = band * context.bandTiles;
+            context.remainingTiles[band].storeRelaxed(qMin(context.bandTiles, context.tiles.size() - firstTile));
+        }
+        context.finishedBands.clear();
+    }
+
+    //Render thread works on the tiles as well, unless it has to deliver the
+    //bands while they are finished, so only the rest goes to the pool
+    const bool renderThreadWorks = context.bandTiles == 0;
+    const int workers = qMin(pool.maxThreadCount(), context.tiles.size());
+    for(int i = renderThreadWorks ? 1 : 0; i < workers; ++i)
+    {
+        pool.start([this, &context]()
+        {
+            QThread::currentThread()->setPriority(QThread::LowPriority);
+            renderTiles(context);
+        });
+    }
+
+    if(renderThreadWorks)
+    {
+        renderTiles(context);
+    }
+    else
+    {
+        deliverBands(context);
+    }
+    pool.waitForDone();
+
+    return !isCancelled();
+}
+
+QImage RenderThread::renderPreview(const PassContext &context, int factor)
+{
+    //Same view with fewer and larger pixels, computed row by row without
+    //tiles, cache or resumable state
+    PassContext preview;
+    preview.size = QSize((context.size.width() + factor - 1) / factor, (context.size.height() + factor - 1) / factor);
+    preview.centerX = context.centerX;
+    preview.centerY = context.centerY;
+    preview.scaleFactor = context.scaleFactor * factor;
+    preview.maxIterations = passIterations(0);
+    preview.precision = context.precision;
+    preview.kernel = context.kernel;
+    preview.wideCenterX = context.wideCenterX;
+    preview.wideCenterY = context.wideCenterY;
+    preview.interiorChecks = context.interiorChecks;
+    preview.fractal = context.fractal;
+    preview.orbit = context.orbit;
+    preview.palette = context.palette;
+
+    QImage image = previewFrames.acquire(preview.size);
+    preview.bits = image.bits();
+    preview.bytesPerLine = image.bytesPerLine();
+
+    auto renderRows = [this, &preview]()
+    {
+        const int width = preview.size.width();
+        QVector<int> iterations(width);
+        QVector<quint8> fractions(width);
+        WorkCounters counters;
+        forever
+        {
+            const int y = preview.nextTile.fetchAndAddRelaxed(1);
+            if(y >= preview.size.height() || isCancelled())
+            {
+                break;
+            }
+
+            computeRow(preview, 0, y, width, iterations.data(), fractions.data(),
+                       EscapeKernel::RowState{nullptr, nullptr, nullptr}, &counters);
+            preview.palette.colorize(iterations.constData(), fractions.constData(), width, preview.maxIterations,
+                                     reinterpret_cast<uint*>(preview.bits + y * preview.bytesPerLine));
+        }
+    };
+
+    const int workers = qMin(pool.maxThreadCount(), preview.size.height());
+    for(int i = 1; i < workers; ++i)
+    {
+        pool.start([renderRows]()
+        {
+            QThread::currentThread()->setPriority(QThread::LowPriority);
+            renderRows();
+        });
+    }
+    renderRows();
+    pool.waitForDone();
+
+    return image;
+}
+
+void RenderThread::renderTiles(PassContext &context) const
+{
+    const int halfWidth = context.size.width() / 2;
+    const int halfHeight = context.size.height() / 2;
+    const int MaxIterations = context.maxIterations;
+    bool allBlack = true;
+    WorkCounters counters;
+
+    forever
+    {
+        //Dynamic scheduling, every worker takes the next free tile, so the
+        //expensive parts of the image are spread over all of the workers
+        const int index = context.nextTile.fetchAndAddRelaxed(1);
+        if(index >= context.tiles.size() || isCancelled())
+        {
+            break;
+        }
+
+        //Tile position in the image and relative to the view center
+        const PassContext::Tile& tile = context.tiles.at(index);
+        const int tileLeft = tile.index.x() * TileSize - context.offset.x() + halfWidth;
+        const int tileTop = tile.index.y() * TileSize - context.offset.y() + halfHeight;
+
+        const int stepLimit = EscapeKernel::stepLimit(MaxIterations);
+        PassContext::TileState& state = context.tileStates[index];
+        if(state.steps.isEmpty() && !context.orbit)
+        {
+            state.x.resize(TileSize * TileSize);
+            state.y.resize(TileSize * TileSize);
+            state.steps.resize(TileSize * TileSize);
+        }
+
+        const TileCache::Key key = {context.anchor, tile.index.x(), tile.index.y(), MaxIterations, context.precision,
+                                    context.fractal, context.orbit != nullptr, context.subdivide};
+        const QRect reused = context.usePrevious ? tile.rect & context.previousRect : QRect();
+        QVector<int> iterations;
+        QVector<quint8> fractions;
+        if(!reused.isEmpty())
+        {
+            //Counts of the previous frame are cut down to the step limit of this
+            //pass, pixels which were not on the previous frame are computed
+            const int width = context.size.width();
+            iterations.resize(TileSize * TileSize);
+            fractions.resize(TileSize * TileSize);
+            for(int y = tile.rect.top(); y <= tile.rect.bottom(); ++y)
+            {
+                if(isCancelled())
                 {
                     return;
                 }
 
-                auto scanLine = reinterpret_cast<uint*>(image.scanLine(i + halfHeight));
-                const double ay = centerY +(i*scaleFactor);
+                const int line = (y - tileTop) * TileSize - tileLeft;
+                if(y < reused.top() || y > reused.bottom())
+                {
+                    computeRow(context, tile.rect.left(), y, tile.rect.width(), iterations.data() + line + tile.rect.left(),
+                               fractions.data() + line + tile.rect.left(), state.row(line + tile.rect.left()), &counters);
+                    continue;
+                }
 
+                const int previousLine = (y + context.shift.y()) * width + context.shift.x();
+                const int* previous = context.previous.constData() + previousLine;
+                std::copy(context.previousFractions.constData() + previousLine + reused.left(),
+                          context.previousFractions.constData() + previousLine + reused.right() + 1,
+                          fractions.data() + line + reused.left());
+                for(int x = reused.left(); x <= reused.right(); ++x)
+                {
+                    iterations[line + x] = qMin(previous[x], stepLimit);
+                }
+                if(!context.orbit && context.previousExact)
+                {
+                    keepEscaped(iterations.constData() + line + reused.left(), fractions.constData() + line + reused.left(),
+                                reused.width(), stepLimit, state.row(line + reused.left()));
+                }
+                if(reused.left() > tile.rect.left())
+                {
+                    computeRow(context, tile.rect.left(), y, reused.left() - tile.rect.left(),
+                               iterations.data() + line + tile.rect.left(), fractions.data() + line + tile.rect.left(),
+                               state.row(line + tile.rect.left()), &counters);
+                }
+                if(reused.right() < tile.rect.right())
+                {
+                    computeRow(context, reused.right() + 1, y, tile.rect.right() - reused.right(),
+                               iterations.data() + line + reused.right() + 1, fractions.data() + line + reused.right() + 1,
+                               state.row(line + reused.right() + 1), &counters);
+                }
+            }
+        }
+        else if(context.cacheTiles && context.cache->find(key, &iterations, &fractions))
+        {
+            //Filled in counts must not finish pixels for a later exact pass
+            if(!context.orbit && !context.subdivide)
+            {
+                keepEscaped(iterations.constData(), fractions.constData(), TileSize * TileSize, stepLimit, state.row(0));
+            }
+        }
+        else
+        {
+            //Cached tiles are computed whole, otherwise the visible part is enough
+            const QRect computed = context.cacheTiles ? QRect(0, 0, TileSize, TileSize) :
+                                                        tile.rect.translated(-tileLeft, -tileTop);
+            iterations.resize(TileSize * TileSize);
+            fractions.resize(TileSize * TileSize);
+            auto computeRun = [&](int x, int y, int count)
+            {
+                const int line = y * TileSize + x;
+                computeRow(context, tileLeft + x, tileTop + y, count, iterations.data() + line, fractions.data() + line,
+                           state.row(line), &counters);
+            };
 
-                for(int j = -halfWidth; j < halfWidth; ++j)
+            if(context.subdivide)
+            {
+                //Subdivision starts from the border of the tile
+                computeRun(computed.left(), computed.top(), computed.width());
+                if(computed.height() > 1)
+                {
+                    computeRun(computed.left(), computed.bottom(), computed.width());
+                }
+                for(int y = computed.top() + 1; y < computed.bottom(); ++y)
                 {
-                    if(restart)
+                    computeRun(computed.left(), y, 1);
+                    if(computed.width() > 1)
                     {
-                        break;
+                        computeRun(computed.right(), y, 1);
                     }
-                    else if(abort)
+                }
+                subdivide(context, QPoint(tileLeft, tileTop), computed, iterations.data(), fractions.data(), state.row(0),
+                          &counters);
+                if(isCancelled())
+                {
+                    return;
+                }
+            }
+            else
+            {
+                for(int y = computed.top(); y <= computed.bottom(); ++y)
+                {
+                    if(isCancelled())
                     {
                         return;
                     }
 
-                    const double ax = centerX + (j*scaleFactor);
-                    double a1 = ax;
-                    double b1 = ay;
-                    int numIterations = 0;
+                    computeRun(computed.left(), y, computed.width());
+                }
+            }
 
-                    do
-                    {
-                        ++numIterations;
-                        const double a2 = (a1 * a1) - (b1 * b1) + ax;
-                        const double b2 = (2 * a1 * b1) + ay;
-                        if ((a2 * a2) + (b2 * b2) > Limit)
-                        {
-                            break;
-                        }
-
-                        ++numIterations;
-                        a1 = (a2 * a2) - (b2 * b2) + ax;
-                        b1 = (2 * a2 * b2) + ay;
-                        if ((a1 * a1) + (b1 * b1) > Limit)
-                        {
-                            break;
-                        }
-                    }
-                    while (numIterations < MaxIterations);
+            if(context.cacheTiles)
+            {
+                context.cache->insert(key, iterations, fractions);
+            }
+        }
 
-                    if (numIterations < MaxIterations)
-                    {
-                        *scanLine++ = colormap[numIterations % ColormapSize];
-                        allBlack = false;
-                    }
-                    else
-                    {
-                        *scanLine++ = qRgb(0, 0, 0);
-                    }
+        //Counts go to the frame, colors are a separate pass over them
+        for(int y = tile.rect.top(); y <= tile.rect.bottom(); ++y)
+        {
+            const int offset = (y - tileTop) * TileSize + (tile.rect.left() - tileLeft);
+            const int* line = iterations.constData() + offset;
+            const quint8* fractionLine = fractions.constData() + offset;
+            const int frameOffset = y * context.size.width() + tile.rect.left();
+            std::copy(line, line + tile.rect.width(), context.frame + frameOffset);
+            std::copy(fractionLine, fractionLine + tile.rect.width(), context.frameFractions + frameOffset);
+            allBlack = allBlack && std::all_of(line, line + tile.rect.width(),
+                                               [MaxIterations](int numIterations) { return numIterations >= MaxIterations; });
+            if(context.bits)
+            {
+                context.palette.colorize(line, fractionLine, tile.rect.width(), MaxIterations,
+                                         reinterpret_cast<uint*>(context.bits + y * context.bytesPerLine) +
+                                         tile.rect.left());
+            }
+        }
 
-                    if (allBlack && pass == 0)
-                    {
-                        pass = 4;
-                    }
-                    else
-                    {
-                        if (!restart)
-                        {
-                            emit renderedImage(image, requestedScaleFactor);
-                        }
-                        ++pass;
-                    }
-                }
+        if(context.bandTiles > 0)
+        {
+            const int band = index / context.bandTiles;
+            if(!context.remainingTiles[band].deref())
+            {
+                //Last tile of the band, let the render thread pick it up
+                QMutexLocker lock(&context.bandMutex);
+                context.finishedBands.append(band);
+                context.bandFinished.wakeOne();
             }
         }
-        mutex.lock();
-        if (!restart)
+    }
+
+    if(!allBlack)
+    {
+        context.colored.storeRelaxed(1);
+    }
+    context.computedPixels.fetchAndAddRelaxed(counters.computedPixels);
+    context.iterations.fetchAndAddRelaxed(counters.iterations);
+    context.rebases.fetchAndAddRelaxed(counters.rebases);
+}
+
+void RenderThread::subdivide(const PassContext &context, QPoint tileOrigin, const QRect &rect, int *iterations,
+                             quint8 *fractions, const EscapeKernel::RowState &state, WorkCounters *counters) const
+{
+    //Border of the rect is known, only its inside is left
+    const QRect inside = rect.adjusted(1, 1, -1, -1);
+    if(inside.isEmpty() || isCancelled())
+    {
+        return;
+    }
+
+    auto computeRun = [&](int x, int y, int count)
+    {
+        const int offset = y * TileSize + x;
+        const EscapeKernel::RowState run = state.steps ?
+                    EscapeKernel::RowState{state.x + offset, state.y + offset, state.steps + offset} : state;
+        computeRow(context, tileOrigin.x() + x, tileOrigin.y() + y, count, iterations + offset, fractions + offset, run,
+                   counters);
+    };
+
+    if(inside.width() * inside.height() < MinSubdivisionArea)
+    {
+        for(int y = inside.top(); y <= inside.bottom(); ++y)
         {
-            //If thread should be running, put it in sleep state
-            //in order to save processor time
-            condition.wait(&mutex);
+            computeRun(inside.left(), y, inside.width());
         }
-        restart = false;
-        mutex.unlock();
+        return;
+    }
+
+    const int value = iterations[rect.top() * TileSize + rect.left()];
+    bool uniform = true;
+    for(int x = rect.left(); x <= rect.right() && uniform; ++x)
+    {
+        uniform = iterations[rect.top() * TileSize + x] == value && iterations[rect.bottom() * TileSize + x] == value;
+    }
+    for(int y = inside.top(); y <= inside.bottom() && uniform; ++y)
+    {
+        uniform = iterations[y * TileSize + rect.left()] == value && iterations[y * TileSize + rect.right()] == value;
+    }
+
+    if(uniform)
+    {
+        //Fractions of the border vary, the corner stands for all of them
+        const quint8 fraction = fractions[rect.top() * TileSize + rect.left()];
+        for(int y = inside.top(); y <= inside.bottom(); ++y)
+        {
+            std::fill_n(iterations + y * TileSize + inside.left(), inside.width(), value);
+            std::fill_n(fractions + y * TileSize + inside.left(), inside.width(), fraction);
+        }
+        return;
+    }
+
+    //Split across the longer side, the dividing line is a border of both halves
+    if(rect.width() >= rect.height())
+    {
+        const int middle = (rect.left() + rect.right()) / 2;
+        for(int y = inside.top(); y <= inside.bottom(); ++y)
+        {
+            computeRun(middle, y, 1);
+        }
+        subdivide(context, tileOrigin, QRect(rect.topLeft(), QPoint(middle, rect.bottom())),
+                  iterations, fractions, state, counters);
+        subdivide(context, tileOrigin, QRect(QPoint(middle, rect.top()), rect.bottomRight()),
+                  iterations, fractions, state, counters);
+    }
+    else
+    {
+        const int middle = (rect.top() + rect.bottom()) / 2;
+        computeRun(inside.left(), middle, inside.width());
+        subdivide(context, tileOrigin, QRect(rect.topLeft(), QPoint(rect.right(), middle)),
+                  iterations, fractions, state, counters);
+        subdivide(context, tileOrigin, QRect(QPoint(rect.left(), middle), rect.bottomRight()),
+                  iterations, fractions, state, counters);
+    }
+}
+
+void RenderThread::computeRow(const PassContext &context, int x, int y, int count, int *iterations,
+                              quint8 *fractions, const EscapeKernel::RowState& state, WorkCounters *counters)
+{
+    //Kernels take the pixel position relative to the view center
+    const int column = x - context.size.width() / 2;
+    const int row = y - context.size.height() / 2;
+    const double ay = context.centerY + (row * context.scaleFactor);
+    const bool wide = context.precision == EscapeKernel::DoubleDoublePrecision && !context.orbit;
+    const DoubleDouble wideAy = wide ? context.wideCenterY + (DoubleDouble(row) * DoubleDouble(context.scaleFactor)) :
+                                       DoubleDouble(ay);
+    const int stepLimit = EscapeKernel::stepLimit(context.maxIterations);
+    float magnitudes[MagnitudeChunk];
+    for(int done = 0; done < count; done += MagnitudeChunk)
+    {
+        const int chunk = qMin(MagnitudeChunk, count - done);
+        int* chunkIterations = iterations + done;
+        if(context.orbit)
+        {
+            Perturbation::row(*context.orbit, context.scaleFactor, column + done, row, chunk, context.maxIterations,
+                              chunkIterations, magnitudes, &counters->rebases);
+        }
+        else
+        {
+            const EscapeKernel::RowState chunkState = {state.x + done, state.y + done, state.steps + done};
+            const EscapeKernel::RowState* rowState = state.steps ? &chunkState : nullptr;
+            if(wide)
+            {
+                EscapeKernel::doubleDoubleRow(context.wideCenterX, context.scaleFactor, column + done, wideAy, chunk,
+                                              context.maxIterations, context.interiorChecks, chunkIterations,
+                                              magnitudes, rowState, context.fractal);
+            }
+            else
+            {
+                context.kernel(context.centerX, context.scaleFactor, column + done, ay, chunk, context.maxIterations,
+                               context.interiorChecks, chunkIterations, magnitudes, rowState, context.fractal);
+            }
+        }
+
+        //Escape magnitude becomes the fraction for smooth coloring
+        for(int k = 0; k < chunk; ++k)
+        {
+            fractions[done + k] = chunkIterations[k] < stepLimit ? Palette::fraction(magnitudes[k]) : 0;
+        }
+    }
+
+    counters->computedPixels += count;
+    for(int k = 0; k < count; ++k)
+    {
+        counters->iterations += iterations[k];
     }
 }
 
-uint RenderThread::rgbFromWaveLenght(double wave)
+void RenderThread::deliverBands(PassContext &context)
 {
-    double r = 0;
-    double g = 0;
-    double b = 0;
+    QVector<bool> pending(context.bandCount, false);
+    bool hasPending = false;
+    int finished = 0;
+    QElapsedTimer sinceLastDelivery;
+    sinceLastDelivery.start();
+
+    QMutexLocker lock(&context.bandMutex);
+    while(finished < context.bandCount && !isCancelled())
+    {
+        //Wake up at least once per frame interval, to notice cancellation
+        //and to flush the bands which were held back by the throttling. An
+        //interval of 0 delivers every band at once.
+        const int interval = frameInterval.loadRelaxed();
+        const qint64 remaining = hasPending ? interval - sinceLastDelivery.elapsed() :
+                                              interval > 0 ? interval : BandPollMsecs;
+        if(remaining > 0 && (hasPending || context.finishedBands.isEmpty()))
+        {
+            context.bandFinished.wait(&context.bandMutex, ulong(remaining));
+        }
+
+        for(int band : qAsConst(context.finishedBands))
+        {
+            pending[band] = true;
+        }
+        hasPending = hasPending || !context.finishedBands.isEmpty();
+        finished += context.finishedBands.size();
+        context.finishedBands.clear();
+
+        if(!hasPending || (finished < context.bandCount && sinceLastDelivery.elapsed() < interval))
+        {
+            continue;
+        }
+
+        //Neighbouring bands go out as one region, bands which are still
+        //being rendered must not be copied
+        lock.unlock();
+        for(int band = 0; band < context.bandCount; ++band)
+        {
+            if(!pending[band])
+            {
+                continue;
+            }
+
+            const int first = band;
+            while(band + 1 < context.bandCount && pending[band + 1])
+            {
+                ++band;
+            }
+
+            const QRect region = context.bandRects.at(first).united(context.bandRects.at(band));
+            emit renderedRegion(*context.image, region, context.scaleFactor);
+            std::fill(pending.begin() + first, pending.begin() + band + 1, false);
+        }
+        hasPending = false;
+        sinceLastDelivery.restart();
+        lock.relock();
+    }
+}
+
+void RenderThread::recolor(const Palette &palette)
+{
+    if(lastFrame.maxIterations == 0)
+    {
+        return;
+    }
+
+    QImage image = frames.acquire(lastFrame.size);
+    image.setDevicePixelRatio(lastFrame.devicePixelRatio);
+    uchar* bits = image.bits();
+    const int bytesPerLine = image.bytesPerLine();
+
+    //Rows are spread over the workers like the tiles of a pass
+    QAtomicInt nextRow;
+    auto colorRows = [&]()
+    {
+        const int width = lastFrame.size.width();
+        forever
+        {
+            const int y = nextRow.fetchAndAddRelaxed(1);
+            if(y >= lastFrame.size.height() || isCancelled())
+            {
+                break;
+            }
+
+            palette.colorize(lastFrame.iterations.constData() + y * width, lastFrame.fractions.constData() + y * width,
+                             width, lastFrame.maxIterations, reinterpret_cast<uint*>(bits + y * bytesPerLine));
+        }
+    };
+
+    const int workers = qMin(pool.maxThreadCount(), lastFrame.size.height());
+    for(int i = 1; i < workers; ++i)
+    {
+        pool.start(colorRows);
+    }
+    colorRows();
+    pool.waitForDone();
+
+    //Anti-aliased pixels take the mean of their samples again
+    QAtomicInt nextEdge;
+    auto colorEdges = [&]()
+    {
+        const int samples = lastFrame.edgeSamples;
+        QVector<uint> colors(samples);
+        forever
+        {
+            const int first = nextEdge.fetchAndAddRelaxed(EdgeChunk);
+            if(first >= lastFrame.edgePixels.size() || isCancelled())
+            {
+                break;
+            }
+
+            const int last = qMin(first + EdgeChunk, lastFrame.edgePixels.size());
+            for(int i = first; i < last; ++i)
+            {
+                const int pixel = lastFrame.edgePixels.at(i);
+                const int y = pixel / lastFrame.size.width();
+                reinterpret_cast<uint*>(bits + y * bytesPerLine)[pixel - y * lastFrame.size.width()] =
+                        averageColor(palette, lastFrame.maxIterations, lastFrame.edgeIterations.constData() + i * samples,
+                                     lastFrame.edgeFractions.constData() + i * samples, samples, colors.data());
+            }
+        }
+    };
 
-    if (wave >= 380.0 && wave <= 440.0)
+    const int edgeWorkers = qMin(pool.maxThreadCount(), (lastFrame.edgePixels.size() + EdgeChunk - 1) / EdgeChunk);
+    for(int i = 1; i < edgeWorkers; ++i)
+    {
+        pool.start(colorEdges);
+    }
+    if(edgeWorkers > 0)
     {
-        r = -1.0 * (wave - 440.0) / (440.0 - 380.0);
-        b = 1.0;
+        colorEdges();
     }
-    else if (wave >= 440.0 && wave <= 490.0)
+    pool.waitForDone();
+
+    if(!isCancelled())
     {
-        g = (wave - 440.0) / (490.0 - 440.0);
-        b = 1.0;
+        emit renderedImage(image, lastFrame.scaleFactor);
     }
-    else if (wave >= 490.0 && wave <= 510.0)
+}
+
+void RenderThread::antialias(const PassContext &context, const FixedPoint &centerX, const FixedPoint &centerY,
+                             EscapeKernel::InstructionSet instructionSet, int gridSize, int threshold)
+{
+    QElapsedTimer timer;
+    timer.start();
+    const int width = context.size.width();
+    const int height = context.size.height();
+    const int maxIterations = context.maxIterations;
+    const int samples = gridSize * gridSize;
+
+    //Samples are pixels of a view with gridSize times the resolution. Its
+    //size is zero, so their positions are given relative to the center.
+    PassContext grid;
+    grid.size = QSize(0, 0);
+    grid.centerX = context.centerX;
+    grid.centerY = context.centerY;
+    grid.scaleFactor = context.scaleFactor / gridSize;
+    grid.maxIterations = maxIterations;
+    grid.precision = EscapeKernel::precisionFor(context.centerX, context.centerY, grid.scaleFactor,
+                                                width * gridSize, height * gridSize, maxIterations);
+    grid.kernel = EscapeKernel::rowFunction(instructionSet, grid.precision, context.fractal.formula);
+    if(grid.precision == EscapeKernel::DoubleDoublePrecision)
     {
-        g = 1.0;
-        b = -1.0 * (wave - 510.0) / (510.0 - 490.0);
+        grid.wideCenterX = centerX.toDoubleDouble();
+        grid.wideCenterY = centerY.toDoubleDouble();
     }
-    else if (wave >= 510.0 && wave <= 580.0)
+    grid.interiorChecks = context.interiorChecks;
+    grid.fractal = context.fractal;
+    grid.orbit = context.orbit;
+
+    //Widget may still draw the image of the last pass, the refined one goes
+    //into a buffer of its own
+    QImage image = frames.acquire(context.size);
+    image.setDevicePixelRatio(context.image->devicePixelRatio());
+    uchar* bits = image.bits();
+    const int bytesPerLine = image.bytesPerLine();
+    for(int y = 0; y < height; ++y)
     {
-        r = (wave - 510.0) / (580.0 - 510.0);
-        g = 1.0;
+        std::copy_n(context.bits + y * context.bytesPerLine, width * int(sizeof(uint)), bits + y * bytesPerLine);
     }
-    else if (wave >= 580.0 && wave <= 645.0)
+
+    //Pixel on the other side of the border of the set, or with a count too far off
+    auto isEdge = [&](int x, int y)
+    {
+        const int value = context.frame[y * width + x];
+        const bool inside = value >= maxIterations;
+        auto differs = [&](int neighbour)
+        {
+            return (neighbour >= maxIterations) != inside || (!inside && qAbs(neighbour - value) > threshold);
+        };
+        return (x > 0 && differs(context.frame[y * width + x - 1])) ||
+               (x + 1 < width && differs(context.frame[y * width + x + 1])) ||
+               (y > 0 && differs(context.frame[(y - 1) * width + x])) ||
+               (y + 1 < height && differs(context.frame[(y + 1) * width + x]));
+    };
+
+    QMutex edgeMutex;
+    QVector<int> edgePixels;
+    QVector<int> edgeIterations;
+    QVector<quint8> edgeFractions;
+    QAtomicInt nextRow;
+    QAtomicInteger<qint64> computedSamples;
+    QAtomicInteger<qint64> iterations;
+    auto refineRows = [&]()
+    {
+        QVector<int> pixels;
+        QVector<int> sampleIterations;
+        QVector<quint8> sampleFractions;
+        QVector<uint> colors(samples);
+        WorkCounters counters;
+        const int half = gridSize / 2;
+        forever
+        {
+            const int y = nextRow.fetchAndAddRelaxed(1);
+            if(y >= height || isCancelled())
+            {
+                break;
+            }
+
+            uint* line = reinterpret_cast<uint*>(bits + y * bytesPerLine);
+            for(int x = 0; x < width; ++x)
+            {
+                if(!isEdge(x, y))
+                {
+                    continue;
+                }
+
+                const int first = sampleIterations.size();
+                sampleIterations.resize(first + samples);
+                sampleFractions.resize(first + samples);
+                for(int j = 0; j < gridSize; ++j)
+                {
+                    computeRow(grid, (x - width / 2) * gridSize - half, (y - height / 2) * gridSize + j - half,
+                               gridSize, sampleIterations.data() + first + j * gridSize,
+                               sampleFractions.data() + first + j * gridSize,
+                               EscapeKernel::RowState{nullptr, nullptr, nullptr}, &counters);
+                }
+                pixels.append(y * width + x);
+                line[x] = averageColor(context.palette, maxIterations, sampleIterations.constData() + first,
+                                       sampleFractions.constData() + first, samples, colors.data());
+            }
+        }
+
+        computedSamples.fetchAndAddRelaxed(counters.computedPixels);
+        iterations.fetchAndAddRelaxed(counters.iterations);
+        QMutexLocker lock(&edgeMutex);
+        edgePixels.append(pixels);
+        edgeIterations.append(sampleIterations);
+        edgeFractions.append(sampleFractions);
+    };
+
+    const int workers = qMin(pool.maxThreadCount(), height);
+    for(int i = 1; i < workers; ++i)
     {
-        r = 1.0;
-        g = -1.0 * (wave - 645.0) / (645.0 - 580.0);
+        pool.start([refineRows]()
+        {
+            QThread::currentThread()->setPriority(QThread::LowPriority);
+            refineRows();
+        });
     }
-    else if (wave >= 645.0 && wave <= 780.0)
+    refineRows();
+    pool.waitForDone();
+
+    if(isCancelled())
     {
-        r = 1.0;
+        return;
     }
 
-    double s = 1.0;
-    if (wave > 700.0)
+    AntialiasStats stats;
+    stats.edgePixels = edgePixels.size();
+    stats.pixels = qint64(width) * height;
+    stats.samples = computedSamples.loadRelaxed();
+    stats.iterations = iterations.loadRelaxed();
+    stats.nsecs = timer.nsecsElapsed();
+
+    lastFrame.edgePixels = edgePixels;
+    lastFrame.edgeIterations = edgeIterations;
+    lastFrame.edgeFractions = edgeFractions;
+    lastFrame.edgeSamples = samples;
+
+    mutex.lock();
+    antialiasing = stats;
+    mutex.unlock();
+
+    emit renderedImage(image, context.scaleFactor);
+}
+
+bool RenderThread::isCancelled() const
+{
+    return requestGeneration.loadRelaxed() != activeGeneration || abort.loadRelaxed() || preempted.loadRelaxed();
+}
+
+bool RenderThread::nextSpeculation()
+{
+    if(zoomRatio <= 0 || speculationLevels <= 0 || speculativePasses(resultSize) == 0)
     {
-        s = 0.3 + 0.7 * (780.0 - wave) / (780.0 - 700.0);
+        return false;
     }
-    else if (wave <  420.0)
+
+    //First level ahead of the requested view which is not rendered yet
+    double scale = scaleFactor;
+    for(int level = 0; level < speculationLevels; ++level)
     {
-        s = 0.3 + 0.7 * (wave - 380.0) / (420.0 - 380.0);
+        scale *= zoomRatio;
+        if(findSpeculated(centerX, centerY, scale, resultSize) < 0)
+        {
+            speculativeScale = scale;
+            return true;
+        }
     }
+    return false;
+}
 
-    r = std::pow(r * s, 0.8);
-    g = std::pow(g * s, 0.8);
-    b = std::pow(b * s, 0.8);
+int RenderThread::speculativePasses(QSize size) const
+{
+    //Tiles of every level ahead may take half of the cache, the requested
+    //view keeps the other half
+    const qint64 tiles = qint64(size.width() / TileSize + 2) * (size.height() / TileSize + 2);
+    const qint64 passBytes = tiles * TileSize * TileSize * qint64(sizeof(int) + sizeof(quint8));
+    return int(qMin<qint64>(SpeculativePasses, tileCache.maxBytes() / 2 / (qMax(1, speculationLevels) * passBytes)));
+}
 
-    return qRgb(int(r * 255), int(g * 255), int(b * 255));
+int RenderThread::findSpeculated(const FixedPoint& centerX, const FixedPoint& centerY, double scaleFactor,
+                                 QSize size) const
+{
+    for(int i = 0; i < speculated.size(); ++i)
+    {
+        const SpeculativeView& view = speculated.at(i);
+        if((view.centerX - centerX).isZero() && (view.centerY - centerY).isZero() && view.size == size &&
+                std::fabs(view.scaleFactor - scaleFactor) <= SpeculativeScaleTolerance * scaleFactor)
+        {
+            return i;
+        }
+    }
+    return -1;
 }
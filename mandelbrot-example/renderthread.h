@@ -6,40 +6,315 @@
 #include <QMutex>
 #include <QWaitCondition>
 #include <QSize>
+#include <QThreadPool>
+#include <QAtomicInt>
+#include <QVector>
+#include <QPoint>
+#include <QRect>
+#include <QElapsedTimer>
+
+#include "escapekernel.h"
+#include "fixedpoint.h"
+#include "framering.h"
+#include "palette.h"
+#include "tilecache.h"
 
 class RenderThread : public QThread
 {
     Q_OBJECT
 public:
+    enum DeliveryMode
+    {
+        //One full image for every completed pass
+        PassDelivery,
+        //First pass as a full image, the following passes in bands of scanlines
+        BandDelivery
+    };
+
+    enum SubdivisionMode
+    {
+        //Every pixel is computed
+        NoSubdivision,
+        //Rectangles with a border of one iteration count are filled without
+        //computing their inside, except in the last pass, which is exact
+        SubdividePreviews,
+        SubdivideAllPasses
+    };
+
+    enum PerturbationMode
+    {
+        //Deep zoom below Perturbation::DeepZoomScale
+        PerturbationAuto,
+        PerturbationOff,
+        PerturbationOn
+    };
+
+    //Progressive passes of a render, each with four times the iterations
+    enum {PassCount = 8};
+
+    //Emitted after every completed pass
+    struct PassStats
+    {
+        int pass = 0;
+        int maxIterations = 0;
+        //Pixels of the image and the ones a kernel computed, the others came
+        //from the tile cache, the previous frame or were filled in by subdivision
+        qint64 pixels = 0;
+        qint64 computedPixels = 0;
+        //Sum of the iteration counts of the computed pixels
+        qint64 iterations = 0;
+        int rebases = 0;
+        qint64 nsecs = 0;
+        //Time since render() was called for the view
+        qint64 sinceRequestNsecs = 0;
+        //Pass delivered the first image of the view
+        bool firstImage = false;
+    };
+
+    //Requests go into a mailbox, the thread only takes the latest of them
+    struct RequestStats
+    {
+        qint64 requests = 0;
+        //Replaced by a newer request before the thread took them
+        qint64 coalesced = 0;
+        //Renders, also of views rendered ahead, stopped by a newer request
+        qint64 cancelled = 0;
+        //From the request which cancelled a render until its workers stopped
+        qint64 cancelNsecs = 0;
+        qint64 maxCancelNsecs = 0;
+    };
+
+    //Views of the zoom direction rendered ahead into the tile cache
+    struct SpeculationStats
+    {
+        qint64 views = 0;
+        //Requested afterwards
+        qint64 hits = 0;
+        //Dropped, because the user scrolled or zoomed somewhere else
+        qint64 misses = 0;
+    };
+
+    //Of the last anti-aliasing pass
+    struct AntialiasStats
+    {
+        //Pixels found on an edge, each of them got the samples of a grid
+        qint64 edgePixels = 0;
+        qint64 pixels = 0;
+        qint64 samples = 0;
+        qint64 iterations = 0;
+        qint64 nsecs = 0;
+    };
+
     RenderThread(QObject* parent= nullptr);
     ~RenderThread();
 
-    void render(double centerX, double centerY, double scaleFactor, QSize resultSize,
+    void render(const FixedPoint& centerX, const FixedPoint& centerY, double scaleFactor, QSize resultSize,
                 double devicePixelRatio);
 
+    //Iteration limit of a pass, four times the one of the pass before
+    static int passIterations(int pass);
+
+    //Number of worker threads used to compute the tiles of a pass
+    void setThreadCount(int threadCount);
+    int threadCount() const;
+
+    //Instruction set of the escape time kernel, defaults to the best one the CPU supports
+    void setInstructionSet(EscapeKernel::InstructionSet instructionSet);
+    EscapeKernel::InstructionSet instructionSet() const;
+
+    //Combination of EscapeKernel::InteriorCheck flags, all of them are on by default
+    void setInteriorChecks(int interiorChecks);
+    int interiorChecks() const;
+
+    //Formula of the rendered set and its parameters, the Mandelbrot set by
+    //default. Deep zoom by perturbation is only available for that one.
+    void setFractal(const EscapeKernel::Fractal& fractal);
+    EscapeKernel::Fractal fractal() const;
+
+    //Mariani-Silver subdivision of the tiles, off by default
+    void setSubdivisionMode(SubdivisionMode mode);
+    SubdivisionMode subdivisionMode() const;
+
+    //Deep zoom computes one reference orbit in fixed point precision and
+    //every pixel as a double precision delta off that orbit
+    void setPerturbationMode(PerturbationMode mode);
+    PerturbationMode perturbationMode() const;
+
+    //Memory for the iteration counts of recently rendered tiles, zero disables the cache
+    void setTileCacheSize(qint64 bytes);
+    TileCache::Stats tileCacheStats() const;
+    //File which keeps the tiles of the cache across runs, see TileCache::setStore
+    bool setTileStore(const QString& fileName, qint64 maxBytes, QString* error);
+
+    //Band height is rounded up to whole tiles
+    void setDeliveryMode(DeliveryMode mode, int bandHeight = 64);
+    DeliveryMode deliveryMode() const;
+
+    //Minimal time between two delivered bands, normally the display refresh
+    //interval. 0 delivers every band as soon as it is finished.
+    void setFrameInterval(int msecs);
+
+    //Time a low resolution preview of a new view may take before the first
+    //pass, its resolution follows how long the last one took. Zero disables it.
+    void setPreviewBudget(int msecs);
+    int previewBudget() const;
+
+    //Zoom levels rendered ahead, with the ratio of the last two views around
+    //the same center, while the view is finished. They only fill the tile
+    //cache, so the next wheel step finds its tiles there. Zero disables it.
+    void setSpeculativeLevels(int levels);
+    int speculativeLevels() const;
+    SpeculationStats speculationStats() const;
+
+    //Anti-aliasing pass after the last one. Pixels whose iteration count
+    //differs by more than the threshold from one of their neighbours, or
+    //which border the set, get gridSize x gridSize samples, so its cost
+    //follows the length of the edges rather than the size of the image.
+    //Even sizes are rounded up, the grid is centered on the pixel. Below two
+    //it is off, which is the default.
+    void setAntialiasing(int gridSize, int threshold = 8);
+    int antialiasGridSize() const;
+    AntialiasStats antialiasStats() const;
+
+    //Colors of the image. Changes are applied to the last rendered image from
+    //its iteration counts, without computing it again.
+    void setPaletteOffset(double offset);
+    void setSmoothColoring(bool smooth);
+
+    //Images come from a ring of buffers, which are reused as soon as the
+    //receivers dropped every copy of them
+    FrameRing::Stats frameBufferStats() const;
+
+    //Renders which a newer request cancelled while they were in progress
+    qint64 restartCount() const;
+    RequestStats requestStats() const;
+
 signals:
+    //Receivers may keep the image and draw into it, holding on to too many
+    //of them makes the render thread allocate new ones
     void renderedImage(const QImage& image, double scaleFactor);
+    //Region of the image of a following pass is finished and refines the last
+    //delivered image. The rest of the image is still being drawn.
+    void renderedRegion(const QImage& image, const QRect& region, double scaleFactor);
+    void passFinished(const RenderThread::PassStats& stats);
 
 protected:
     void run() override;
 
 private:
+    struct PassContext;
+    struct WorkCounters;
 
-    static uint rgbFromWaveLenght(double);
+    bool renderPass(PassContext& context);
+    QImage renderPreview(const PassContext& context, int factor);
+    void renderTiles(PassContext& context) const;
+    void subdivide(const PassContext& context, QPoint tileOrigin, const QRect& rect, int* iterations,
+                   quint8* fractions, const EscapeKernel::RowState& state, WorkCounters* counters) const;
+    static void computeRow(const PassContext& context, int x, int y, int count, int* iterations,
+                           quint8* fractions, const EscapeKernel::RowState& state, WorkCounters* counters);
+    void deliverBands(PassContext& context);
+    void antialias(const PassContext& context, const FixedPoint& centerX, const FixedPoint& centerY,
+                   EscapeKernel::InstructionSet instructionSet, int gridSize, int threshold);
+    void recolor(const Palette& palette);
+    bool isCancelled() const;
+    bool nextSpeculation();
+    int speculativePasses(QSize size) const;
+    int findSpeculated(const FixedPoint& centerX, const FixedPoint& centerY, double scaleFactor, QSize size) const;
 
 private:
-    QMutex mutex;
+    mutable QMutex mutex;
     QWaitCondition condition;
-    double centerX;
-    double centerY;
-    double scaleFactor;
-    double devicePixelRatio;
+    QThreadPool pool;
+    TileCache tileCache;
+    FrameRing frames;
+    FrameRing previewFrames;
+    FixedPoint centerX;
+    FixedPoint centerY;
+    double scaleFactor = 0;
+    double devicePixelRatio = 1;
     QSize resultSize;
-    bool restart = false;
-    bool abort = false;
+    EscapeKernel::InstructionSet kernelInstructionSet;
+    int kernelInteriorChecks = EscapeKernel::CardioidCheck | EscapeKernel::PeriodicityCheck;
+    EscapeKernel::Fractal kernelFractal;
+    SubdivisionMode subdivision = NoSubdivision;
+    PerturbationMode perturbation = PerturbationAuto;
+    DeliveryMode delivery = PassDelivery;
+    int bandHeight = 64;
+    QAtomicInt frameInterval;
+    int previewMsecs = 16;
+    Palette palette;
+    bool paletteChanged = false;
+    //Preview has 1/previewFactor of the resolution in either direction
+    int previewFactor = 8;
+    //Mailbox of the requests, render() stores the view and counts up the
+    //generation. The render in progress is cancelled as soon as the
+    //generation differs from the one it took.
+    QAtomicInteger<quint64> requestGeneration;
+    quint64 activeGeneration = 0;
+    QElapsedTimer requestTimer;
+    bool rendering = false;
+    //Started by the request which cancelled the render in progress
+    QElapsedTimer cancelTimer;
+    bool cancelPending = false;
+    RequestStats requests;
+    QAtomicInt abort;
 
-    enum {ColormapSize = 512};
-    uint colormap[ColormapSize];
+    //Ratio of the scale to the one of the request before, zero unless the
+    //last request zoomed around the same center
+    double zoomRatio = 0;
+    int speculationLevels = 2;
+    //Set while a predicted view is rendered, preempted cancels it for a
+    //palette change, render() cancels it as any other render
+    bool speculating = false;
+    double speculativeScale = 0;
+    QAtomicInt preempted;
+    //Request was rendered ahead, its first pass comes from the cache
+    bool requestSpeculated = false;
+    struct SpeculativeView
+    {
+        FixedPoint centerX;
+        FixedPoint centerY;
+        double scaleFactor;
+        QSize size;
+    };
+    //Rendered ahead and not requested yet
+    QVector<SpeculativeView> speculated;
+    SpeculationStats speculation;
+
+    int antialiasGrid = 0;
+    int antialiasThreshold = 8;
+    AntialiasStats antialiasing;
+
+    //Iteration counts of the last rendered image. A view on the same grid,
+    //which was only scrolled, takes the overlapping part from there, palette
+    //changes color it again.
+    struct Frame
+    {
+        QVector<int> iterations;
+        //Fractional escape times for smooth coloring, in 1/256
+        QVector<quint8> fractions;
+        QSize size;
+        double scaleFactor = 0;
+        double devicePixelRatio = 1;
+        int anchor = -1;
+        EscapeKernel::Precision precision = EscapeKernel::DoublePrecision;
+        bool perturbation = false;
+        EscapeKernel::Fractal fractal;
+        QPoint offset;
+        //Of the last completed pass, later passes may have refined some pixels
+        int maxIterations = 0;
+        //False when parts of it were filled in by subdivision
+        bool exact = true;
+        //Anti-aliased pixels and their samples, edgeSamples of them per
+        //pixel, recolored along with the image
+        QVector<int> edgePixels;
+        QVector<int> edgeIterations;
+        QVector<quint8> edgeFractions;
+        int edgeSamples = 0;
+    };
+    Frame lastFrame;
 };
 
+Q_DECLARE_METATYPE(RenderThread::PassStats)
+
 #endif // RENDERTHREAD_H
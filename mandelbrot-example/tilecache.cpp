@@ -0,0 +1,249 @@
+#include "tilecache.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <cmath>
+#include <climits>
+
+namespace
+{
+//Grids for older views are forgotten, their tiles age out of the cache
+const int MaxAnchors = 64;
+//Scales closer than this are the same, zooming in and out again does not
+//give back the exact same double
+const double ScaleTolerance = 1e-9;
+//View centers further off whole pixels than this use their own grid
+const double PhaseTolerance = 1e-3;
+
+//Splits a coordinate into the start of its tile on the grid through zero and
+//its position in that tile, in steps of PhaseTolerance pixels
+FixedPoint tileOrigin(const FixedPoint &coordinate, double scaleFactor, qint64 *position)
+{
+    const double tileWidth = TileStore::TileSize * scaleFactor;
+    const FixedPoint tile(tileWidth);
+
+    //Whole tiles are taken off in counts which fit the integer limb, so every
+    //product is exact and the origin is the same whichever view it came from
+    FixedPoint rest = coordinate;
+    for(;;)
+    {
+        const double tiles = std::trunc(rest.toDouble() / tileWidth);
+        if(tiles == 0)
+        {
+            break;
+        }
+        int exponent = 0;
+        std::frexp(tiles, &exponent);
+        const int shift = qMax(0, exponent - 30);
+        rest -= FixedPoint(std::trunc(std::ldexp(tiles, -shift))) * FixedPoint(std::ldexp(tileWidth, shift));
+    }
+
+    //Rest is now less than a tile either side of zero
+    const qint64 tileSteps = qRound64(TileStore::TileSize / PhaseTolerance);
+    const qint64 steps = qRound64(rest.toDouble() / scaleFactor / PhaseTolerance);
+    const int carry = steps < 0 ? -1 : steps >= tileSteps ? 1 : 0;
+    *position = steps - carry * tileSteps;
+    return (coordinate - rest + FixedPoint(double(carry)) * tile).withFractionLimbs(tile.fractionLimbs());
+}
+}
+
+TileCache::TileCache(qint64 maxBytes)
+{
+    tiles.setMaxCost(int(qMin<qint64>(maxBytes, INT_MAX)));
+}
+
+void TileCache::setMaxBytes(qint64 maxBytes)
+{
+    QMutexLocker lock(&mutex);
+    const int before = tiles.count();
+    tiles.setMaxCost(int(qBound<qint64>(0, maxBytes, INT_MAX)));
+    counters.evictions += before - tiles.count();
+}
+
+qint64 TileCache::maxBytes() const
+{
+    QMutexLocker lock(&mutex);
+    return tiles.maxCost();
+}
+
+bool TileCache::setStore(const QString &fileName, qint64 maxBytes, QString *error)
+{
+    if(fileName.isEmpty() || maxBytes <= 0)
+    {
+        store.close();
+        return true;
+    }
+    return store.open(fileName, maxBytes, error);
+}
+
+int TileCache::anchor(const FixedPoint &centerX, const FixedPoint &centerY, double scaleFactor, QPoint *offset)
+{
+    QMutexLocker lock(&mutex);
+    for(const Anchor& anchor : qAsConst(anchors))
+    {
+        if(std::fabs(anchor.scaleFactor - scaleFactor) > ScaleTolerance * scaleFactor)
+        {
+            continue;
+        }
+
+        const double dx = (centerX - anchor.x).toDouble() / scaleFactor;
+        const double dy = (centerY - anchor.y).toDouble() / scaleFactor;
+        const double rx = std::round(dx);
+        const double ry = std::round(dy);
+        if(std::fabs(dx - rx) < PhaseTolerance && std::fabs(dy - ry) < PhaseTolerance &&
+           std::fabs(rx) < INT_MAX / 2 && std::fabs(ry) < INT_MAX / 2)
+        {
+            *offset = QPoint(int(rx), int(ry));
+            return anchor.id;
+        }
+    }
+
+    if(anchors.size() >= MaxAnchors)
+    {
+        anchors.removeFirst();
+    }
+
+    //Tile 0 of the grid starts at a whole tile from zero, so every run lays the
+    //same tiles for the same scale and phase
+    qint64 positionX = 0;
+    qint64 positionY = 0;
+    const FixedPoint originX = tileOrigin(centerX, scaleFactor, &positionX);
+    const FixedPoint originY = tileOrigin(centerY, scaleFactor, &positionY);
+    const qint64 pixelSteps = qRound64(1 / PhaseTolerance);
+    *offset = QPoint(int(positionX / pixelSteps), int(positionY / pixelSteps));
+    const FixedPoint step(scaleFactor);
+    anchors.append({nextAnchor, scaleFactor,
+                    centerX - FixedPoint(double(offset->x())) * step, centerY - FixedPoint(double(offset->y())) * step,
+                    originX, originY, int(positionX % pixelSteps), int(positionY % pixelSteps)});
+    return nextAnchor++;
+}
+
+bool TileCache::find(const Key &key, QVector<int> *iterations, QVector<quint8> *fractions)
+{
+    QMutexLocker lock(&mutex);
+    const Tile* tile = tiles.object(key);
+    if(tile)
+    {
+        ++counters.hits;
+        *iterations = tile->iterations;
+        *fractions = tile->fractions;
+        return true;
+    }
+
+    ++counters.misses;
+    const Anchor* grid = store.isOpen() ? findAnchor(key.anchor) : nullptr;
+    if(!grid)
+    {
+        return false;
+    }
+
+    //The other workers keep using the memory while the file is read
+    const Anchor position = *grid;
+    lock.unlock();
+    if(!store.find(storeKey(position, key), key.maxIterations, iterations, fractions))
+    {
+        return false;
+    }
+
+    lock.relock();
+    ++counters.diskHits;
+    cacheTile(key, *iterations, *fractions);
+    return true;
+}
+
+void TileCache::insert(const Key &key, const QVector<int> &iterations, const QVector<quint8> &fractions)
+{
+    QMutexLocker lock(&mutex);
+    if(tiles.maxCost() == 0)
+    {
+        return;
+    }
+    cacheTile(key, iterations, fractions);
+
+    //Subdivided tiles are not exact enough to keep
+    const Anchor* grid = !key.subdivided && store.isOpen() ? findAnchor(key.anchor) : nullptr;
+    if(!grid)
+    {
+        return;
+    }
+
+    const Anchor position = *grid;
+    lock.unlock();
+    store.insert(storeKey(position, key), key.maxIterations, iterations, fractions);
+}
+
+TileCache::Stats TileCache::stats() const
+{
+    QMutexLocker lock(&mutex);
+    Stats result = counters;
+    result.tiles = tiles.count();
+    result.bytes = tiles.totalCost();
+    result.diskBytes = store.stats().bytes;
+    return result;
+}
+
+void TileCache::clear()
+{
+    QMutexLocker lock(&mutex);
+    tiles.clear();
+    anchors.clear();
+}
+
+void TileCache::cacheTile(const Key &key, const QVector<int> &iterations, const QVector<quint8> &fractions)
+{
+    const bool replaced = tiles.contains(key);
+    const int before = tiles.count();
+    tiles.insert(key, new Tile{iterations, fractions}, iterations.size() * int(sizeof(int)) + fractions.size());
+    counters.evictions += before + (replaced ? 0 : 1) - tiles.count();
+}
+
+const TileCache::Anchor* TileCache::findAnchor(int id) const
+{
+    for(const Anchor& anchor : anchors)
+    {
+        if(anchor.id == id)
+        {
+            return &anchor;
+        }
+    }
+    return nullptr;
+}
+
+QByteArray TileCache::storeKey(const Anchor &anchor, const Key &key)
+{
+    //Position of the tile on the grid through zero, the iterations are up to the store
+    const FixedPoint tile(TileStore::TileSize * anchor.scaleFactor);
+    const FixedPoint x = anchor.originX + FixedPoint(double(key.tileX)) * tile;
+    const FixedPoint y = anchor.originY + FixedPoint(double(key.tileY)) * tile;
+
+    QByteArray position;
+    QDataStream stream(&position, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_12);
+    stream << anchor.scaleFactor << x << y << qint32(anchor.phaseX) << qint32(anchor.phaseY)
+           << qint32(key.precision) << key.perturbation << qint32(TileStore::TileSize);
+    //Tiles of the Mandelbrot set keep the keys they had before there were other formulas
+    if(key.fractal.formula != EscapeKernel::Mandelbrot)
+    {
+        stream << qint32(key.fractal.formula);
+    }
+    if(key.fractal.formula == EscapeKernel::Julia)
+    {
+        stream << key.fractal.juliaX << key.fractal.juliaY;
+    }
+    return QCryptographicHash::hash(position, QCryptographicHash::Md5);
+}
+
+bool operator==(const TileCache::Key &a, const TileCache::Key &b)
+{
+    return a.anchor == b.anchor && a.tileX == b.tileX && a.tileY == b.tileY &&
+            a.maxIterations == b.maxIterations && a.precision == b.precision && a.fractal == b.fractal &&
+            a.perturbation == b.perturbation && a.subdivided == b.subdivided;
+}
+
+uint qHash(const TileCache::Key &key, uint seed)
+{
+    return qHash(quint64(uint(key.anchor)) << 32 | uint(key.maxIterations), seed) ^
+            qHash(quint64(uint(key.tileX)) << 32 | uint(key.tileY), seed) ^
+            (uint(key.fractal.formula) << 4 | uint(key.precision) << 2 | uint(key.perturbation) << 1 |
+             uint(key.subdivided));
+}
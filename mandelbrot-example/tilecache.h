@@ -0,0 +1,110 @@
+#ifndef TILECACHE_H
+#define TILECACHE_H
+
+#include <QCache>
+#include <QMutex>
+#include <QPoint>
+#include <QVector>
+
+#include "escapekernel.h"
+#include "fixedpoint.h"
+#include "tilestore.h"
+
+//Bounded LRU cache of the iteration counts and fractions of rendered
+//tiles. Tiles are laid out on a grid anchored in the fractal plane, so
+//views with the same scale which differ by whole pixels share their tiles.
+//Behind it an optional TileStore keeps the tiles across runs. All members
+//are thread safe.
+class TileCache
+{
+public:
+    struct Key
+    {
+        //Identifies scale and pixel phase of the grid, see anchor()
+        int anchor;
+        int tileX;
+        int tileY;
+        int maxIterations;
+        EscapeKernel::Precision precision;
+        EscapeKernel::Fractal fractal;
+        //Computed off a reference orbit instead of by the kernels, the
+        //precision is the same either way
+        bool perturbation;
+        //Filled in by subdivision instead of computed for every pixel
+        bool subdivided;
+    };
+
+    struct Stats
+    {
+        qint64 hits = 0;
+        qint64 misses = 0;
+        qint64 evictions = 0;
+        int tiles = 0;
+        qint64 bytes = 0;
+        //Misses of the memory found in the file of the store
+        qint64 diskHits = 0;
+        qint64 diskBytes = 0;
+    };
+
+    explicit TileCache(qint64 maxBytes = 64 * 1024 * 1024);
+
+    //Zero disables the cache
+    void setMaxBytes(qint64 maxBytes);
+    qint64 maxBytes() const;
+
+    //Exact tiles are written to a store in the file as well, and misses are
+    //looked up there. Keys of the file are the positions of the tiles in the
+    //plane, so a later run finds the tiles of every view with the same scale
+    //and pixel phase. An empty file name or zero bytes close the store.
+    bool setStore(const QString& fileName, qint64 maxBytes, QString* error);
+
+    //Finds or creates the grid for the view. Grids start at whole tiles from
+    //zero of the plane. Offset receives the position of the view center on
+    //the grid, in pixels.
+    int anchor(const FixedPoint& centerX, const FixedPoint& centerY, double scaleFactor, QPoint* offset);
+
+    bool find(const Key& key, QVector<int>* iterations, QVector<quint8>* fractions);
+    void insert(const Key& key, const QVector<int>& iterations, const QVector<quint8>& fractions);
+
+    Stats stats() const;
+    void clear();
+
+private:
+    struct Anchor
+    {
+        int id;
+        double scaleFactor;
+        //Pixel 0 of the grid
+        FixedPoint x;
+        FixedPoint y;
+        //Start of tile 0 and the phase of the pixels in it, for the keys of the store
+        FixedPoint originX;
+        FixedPoint originY;
+        int phaseX;
+        int phaseY;
+    };
+
+    struct Tile
+    {
+        QVector<int> iterations;
+        QVector<quint8> fractions;
+    };
+
+    mutable QMutex mutex;
+    QCache<Key, Tile> tiles;
+    QVector<Anchor> anchors;
+    int nextAnchor = 0;
+    Stats counters;
+    TileStore store;
+
+    //Callers hold the mutex
+    void cacheTile(const Key& key, const QVector<int>& iterations, const QVector<quint8>& fractions);
+    const Anchor* findAnchor(int id) const;
+
+    static QByteArray storeKey(const Anchor& anchor, const Key& key);
+};
+
+bool operator==(const TileCache::Key& a, const TileCache::Key& b);
+uint qHash(const TileCache::Key& key, uint seed = 0);
+
+#endif // TILECACHE_H
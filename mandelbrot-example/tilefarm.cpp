@@ -0,0 +1,466 @@
+#include "tilefarm.h"
+
+#include "escapekernel.h"
+#include "palette.h"
+
+#include <QDataStream>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QHash>
+#include <QLocalSocket>
+#include <QMutexLocker>
+#include <QTcpSocket>
+#include <QTimer>
+
+namespace
+{
+//Pixels per kernel call, limits the buffer of the escape magnitudes
+const int MagnitudeChunk = 256;
+
+//Tiles a worker holds at once, so it never waits for the next one
+const int InFlightTiles = 4;
+
+//Workers a tile may fail on before the render gives up
+const int MaxAttempts = 3;
+
+//How often the render looks for a cancel and for workers which stopped answering
+const int PollMsecs = 50;
+
+//A worker holding tiles which sends no result for this long has failed
+const int AnswerTimeoutMsecs = 120000;
+
+//Ends malformed messages early, a tile of 64k x 64k pixels is far beyond any export
+const quint32 MaxMessageBytes = 1u << 30;
+
+//Largest tile whose counts and fractions fit a message, with room for the header
+const qint64 MaxTilePixels = (MaxMessageBytes - 1024) / (sizeof(qint32) + sizeof(quint8));
+
+enum MessageType : quint8
+{
+    TileMessage = 1,
+    ResultMessage = 2
+};
+
+//Workers may run another Qt version
+const int StreamVersion = QDataStream::Qt_5_12;
+
+QByteArray frame(const QByteArray& payload)
+{
+    QByteArray message;
+    QDataStream stream(&message, QIODevice::WriteOnly);
+    stream.setVersion(StreamVersion);
+    stream << quint32(payload.size());
+    message.append(payload);
+    return message;
+}
+}
+
+struct TileFarm::Worker
+{
+    QString address;
+    QIODevice* socket = nullptr;
+    QByteArray buffer;
+    //Indices of the tiles sent and not answered yet
+    QVector<int> tiles;
+    //Since the last result, or since it got tiles after it had none
+    QElapsedTimer sinceAnswer;
+    bool connected = false;
+    bool failed = false;
+};
+
+TileFarm::TileFarm(const QStringList &workers, QObject *parent) : QObject(parent),
+    addresses(workers)
+{
+}
+
+bool TileFarm::render(const QVector<Tile> &tiles, const std::function<void (const Result &)> &resultReady,
+                      const std::function<bool ()> &isCancelled, QString *error)
+{
+    counters = Stats();
+    counters.workerTiles.fill(0, addresses.size());
+    if(addresses.isEmpty())
+    {
+        *error = tr("No workers");
+        return false;
+    }
+    for(const Tile& tile : tiles)
+    {
+        if(!isValid(tile))
+        {
+            *error = tr("Tile %1 is too large or has too many steps for the workers").arg(tile.id);
+            return false;
+        }
+    }
+
+    QHash<int, int> indices;
+    for(int i = 0; i < tiles.size(); ++i)
+    {
+        indices.insert(tiles.at(i).id, i);
+    }
+    QVector<int> pending;
+    for(int i = 0; i < tiles.size(); ++i)
+    {
+        pending.append(i);
+    }
+    QVector<int> attempts(tiles.size(), 0);
+    QVector<bool> finished(tiles.size(), false);
+    int finishedCount = 0;
+
+    QEventLoop loop;
+    QVector<Worker> workers(addresses.size());
+    bool succeeded = tiles.isEmpty();
+    //Sockets may fail while they connect, before the loop runs
+    bool stopped = succeeded;
+    auto stop = [&]()
+    {
+        stopped = true;
+        loop.quit();
+    };
+
+    //Fills every working worker up to its share of tiles in flight
+    auto dispatch = [&]()
+    {
+        for(Worker& worker : workers)
+        {
+            while(worker.connected && !worker.failed && worker.tiles.size() < InFlightTiles && !pending.isEmpty())
+            {
+                if(worker.tiles.isEmpty())
+                {
+                    worker.sinceAnswer.start();
+                }
+                const int index = pending.takeFirst();
+                worker.tiles.append(index);
+                worker.socket->write(encode(tiles.at(index)));
+            }
+        }
+    };
+
+    auto fail = [&](int workerIndex, const QString& reason)
+    {
+        Worker& worker = workers[workerIndex];
+        if(worker.failed)
+        {
+            return;
+        }
+        worker.failed = true;
+        ++counters.failedWorkers;
+        counters.failures.append(worker.address + QStringLiteral(": ") + reason);
+
+        //Tiles go back to the front of the queue, the others are waiting longest
+        for(int i = worker.tiles.size() - 1; i >= 0; --i)
+        {
+            const int index = worker.tiles.at(i);
+            if(++attempts[index] >= MaxAttempts)
+            {
+                *error = tr("Tile %1 failed on %2 workers").arg(tiles.at(index).id).arg(MaxAttempts);
+                stop();
+                return;
+            }
+            pending.prepend(index);
+            ++counters.retries;
+        }
+        worker.tiles.clear();
+
+        bool left = false;
+        for(const Worker& other : qAsConst(workers))
+        {
+            left = left || !other.failed;
+        }
+        if(!left)
+        {
+            *error = tr("Every worker failed, the last one with: %1").arg(reason);
+            stop();
+            return;
+        }
+        dispatch();
+    };
+
+    auto receive = [&](int workerIndex)
+    {
+        Worker& worker = workers[workerIndex];
+        worker.buffer.append(worker.socket->readAll());
+        QByteArray message;
+        while(!worker.failed && takeMessage(&worker.buffer, &message))
+        {
+            Result result;
+            const int index = decode(message, &result) ? indices.value(result.id, -1) : -1;
+            const int pixels = index >= 0 ? tiles.at(index).rect.width() * tiles.at(index).rect.height() : 0;
+            if(index < 0 || result.iterations.size() != pixels || result.fractions.size() != pixels)
+            {
+                fail(workerIndex, tr("Malformed result"));
+                return;
+            }
+
+            //A tile may come back from a worker which was given up on already
+            worker.tiles.removeOne(index);
+            worker.sinceAnswer.start();
+            if(finished.at(index))
+            {
+                continue;
+            }
+            finished[index] = true;
+            ++finishedCount;
+            ++counters.tiles;
+            ++counters.workerTiles[workerIndex];
+            resultReady(result);
+            if(finishedCount == tiles.size())
+            {
+                succeeded = true;
+                stop();
+                return;
+            }
+        }
+        dispatch();
+    };
+
+    for(int i = 0; i < workers.size(); ++i)
+    {
+        Worker& worker = workers[i];
+        worker.address = addresses.at(i);
+        auto connected = [&, i]()
+        {
+            workers[i].connected = true;
+            dispatch();
+        };
+
+        //Anything with a port is a TCP address, the rest names local servers
+        const int colon = worker.address.lastIndexOf(QLatin1Char(':'));
+        bool isPort = false;
+        const quint16 port = colon > 0 ? worker.address.mid(colon + 1).toUShort(&isPort) : 0;
+        if(isPort)
+        {
+            QTcpSocket* socket = new QTcpSocket(this);
+            connect(socket, &QTcpSocket::connected, &loop, connected);
+            connect(socket, &QTcpSocket::errorOccurred, &loop, [&, i, socket]() { fail(i, socket->errorString()); });
+            connect(socket, &QTcpSocket::disconnected, &loop, [&, i]() { fail(i, tr("Disconnected")); });
+            connect(socket, &QTcpSocket::readyRead, &loop, [&, i]() { receive(i); });
+            worker.socket = socket;
+            socket->connectToHost(worker.address.left(colon), port);
+        }
+        else
+        {
+            QLocalSocket* socket = new QLocalSocket(this);
+            connect(socket, &QLocalSocket::connected, &loop, connected);
+            connect(socket, &QLocalSocket::errorOccurred, &loop, [&, i, socket]() { fail(i, socket->errorString()); });
+            connect(socket, &QLocalSocket::disconnected, &loop, [&, i]() { fail(i, tr("Disconnected")); });
+            connect(socket, &QLocalSocket::readyRead, &loop, [&, i]() { receive(i); });
+            worker.socket = socket;
+            socket->connectToServer(worker.address);
+        }
+    }
+
+    QTimer poll;
+    connect(&poll, &QTimer::timeout, &loop, [&]()
+    {
+        if(isCancelled())
+        {
+            *error = tr("Cancelled");
+            stop();
+            return;
+        }
+
+        //Connected workers may hang without ever closing the connection
+        for(int i = 0; i < workers.size() && !stopped; ++i)
+        {
+            const Worker& worker = workers.at(i);
+            if(!worker.failed && !worker.tiles.isEmpty() && worker.sinceAnswer.hasExpired(AnswerTimeoutMsecs))
+            {
+                fail(i, tr("No result for %1 seconds").arg(AnswerTimeoutMsecs / 1000));
+            }
+        }
+    });
+    poll.start(PollMsecs);
+
+    if(!stopped)
+    {
+        loop.exec();
+    }
+
+    //Sockets go away without reporting their disconnect to the finished render
+    for(Worker& worker : workers)
+    {
+        worker.socket->disconnect();
+        delete worker.socket;
+    }
+    return succeeded;
+}
+
+TileFarm::Stats TileFarm::stats() const
+{
+    return counters;
+}
+
+TileFarm::Result TileFarm::compute(const Tile &tile, OrbitCache *orbits)
+{
+    const double centerX = tile.centerX.toDouble();
+    const double centerY = tile.centerY.toDouble();
+    const EscapeKernel::Precision precision = EscapeKernel::precisionFor(centerX, centerY, tile.scaleFactor,
+                                                                         tile.imageSize.width(),
+                                                                         tile.imageSize.height(), tile.maxIterations);
+    const EscapeKernel::RowFunction kernel = EscapeKernel::rowFunction(EscapeKernel::bestInstructionSet(), precision,
+                                                                       tile.fractal.formula);
+    const DoubleDouble wideCenterX = tile.centerX.toDoubleDouble();
+    const DoubleDouble wideCenterY = tile.centerY.toDoubleDouble();
+    const QSharedPointer<const Perturbation::ReferenceOrbit> orbit =
+            tile.fractal.formula == EscapeKernel::Mandelbrot && tile.scaleFactor < Perturbation::DeepZoomScale ?
+                orbits->orbit(tile) : QSharedPointer<const Perturbation::ReferenceOrbit>();
+
+    Result result;
+    result.id = tile.id;
+    result.iterations.resize(tile.rect.width() * tile.rect.height());
+    result.fractions.resize(result.iterations.size());
+    const int stepLimit = EscapeKernel::stepLimit(tile.maxIterations);
+    float magnitudes[MagnitudeChunk];
+    for(int y = tile.rect.top(); y <= tile.rect.bottom(); ++y)
+    {
+        //Same pixel positions as the interactive render, relative to the center
+        const int row = y - tile.imageSize.height() / 2;
+        const double ay = centerY + (row * tile.scaleFactor);
+        const DoubleDouble wideAy = wideCenterY + (DoubleDouble(row) * DoubleDouble(tile.scaleFactor));
+        const int line = (y - tile.rect.top()) * tile.rect.width();
+        for(int done = 0; done < tile.rect.width(); done += MagnitudeChunk)
+        {
+            const int chunk = qMin(MagnitudeChunk, tile.rect.width() - done);
+            const int column = tile.rect.left() + done - tile.imageSize.width() / 2;
+            int* iterations = result.iterations.data() + line + done;
+            if(orbit)
+            {
+                int rebases = 0;
+                Perturbation::row(*orbit, tile.scaleFactor, column, row, chunk, tile.maxIterations, iterations,
+                                  magnitudes, &rebases);
+            }
+            else if(precision == EscapeKernel::DoubleDoublePrecision)
+            {
+                EscapeKernel::doubleDoubleRow(wideCenterX, tile.scaleFactor, column, wideAy, chunk, tile.maxIterations,
+                                              tile.interiorChecks, iterations, magnitudes, nullptr, tile.fractal);
+            }
+            else
+            {
+                kernel(centerX, tile.scaleFactor, column, ay, chunk, tile.maxIterations, tile.interiorChecks,
+                       iterations, magnitudes, nullptr, tile.fractal);
+            }
+
+            quint8* fractions = result.fractions.data() + line + done;
+            for(int k = 0; k < chunk; ++k)
+            {
+                fractions[k] = iterations[k] < stepLimit ? Palette::fraction(magnitudes[k]) : 0;
+            }
+        }
+    }
+    return result;
+}
+
+QSharedPointer<const Perturbation::ReferenceOrbit> TileFarm::OrbitCache::orbit(const Tile &tile)
+{
+    //Reference orbit needs the precision of the center and of the pixel steps
+    const int limbs = qMax(qMax(tile.centerX.fractionLimbs(), tile.centerY.fractionLimbs()),
+                           FixedPoint::fractionLimbsFor(tile.scaleFactor));
+    const int needed = EscapeKernel::stepLimit(tile.maxIterations) + 2;
+
+    QMutexLocker lock(&mutex);
+    if(cached && limbs == fractionLimbs && needed <= length && (tile.centerX - centerX).isZero() &&
+            (tile.centerY - centerY).isZero())
+    {
+        return cached;
+    }
+
+    //Tiles still computing keep the orbit they got, so it is never changed
+    QSharedPointer<Perturbation::ReferenceOrbit> orbit(new Perturbation::ReferenceOrbit);
+    orbit->reset(tile.centerX, tile.centerY, limbs);
+    orbit->extend(needed, []() { return false; });
+    centerX = tile.centerX;
+    centerY = tile.centerY;
+    fractionLimbs = limbs;
+    length = needed;
+    cached = orbit;
+    return cached;
+}
+
+bool TileFarm::isValid(const Tile &tile)
+{
+    return tile.scaleFactor > 0 && tile.maxIterations > 0 && tile.maxIterations <= MaxIterations &&
+            !tile.rect.isEmpty() && QRect(QPoint(0, 0), tile.imageSize).contains(tile.rect) &&
+            qint64(tile.rect.width()) * tile.rect.height() <= MaxTilePixels;
+}
+
+QByteArray TileFarm::encode(const Tile &tile)
+{
+    QByteArray payload;
+    QDataStream stream(&payload, QIODevice::WriteOnly);
+    stream.setVersion(StreamVersion);
+    stream << quint8(TileMessage) << qint32(tile.id) << tile.centerX << tile.centerY << tile.scaleFactor
+           << tile.imageSize << tile.rect << qint32(tile.maxIterations) << qint32(tile.interiorChecks)
+           << qint32(tile.fractal.formula) << tile.fractal.juliaX << tile.fractal.juliaY;
+    return frame(payload);
+}
+
+QByteArray TileFarm::encode(const Result &result)
+{
+    QByteArray payload;
+    QDataStream stream(&payload, QIODevice::WriteOnly);
+    stream.setVersion(StreamVersion);
+    stream << quint8(ResultMessage) << qint32(result.id) << result.iterations << result.fractions;
+    return frame(payload);
+}
+
+bool TileFarm::decode(const QByteArray &message, Tile *tile)
+{
+    QDataStream stream(message);
+    stream.setVersion(StreamVersion);
+    quint8 type = 0;
+    qint32 id = 0;
+    qint32 maxIterations = 0;
+    qint32 interiorChecks = 0;
+    qint32 formula = 0;
+    stream >> type >> id >> tile->centerX >> tile->centerY >> tile->scaleFactor >> tile->imageSize >> tile->rect
+           >> maxIterations >> interiorChecks >> formula >> tile->fractal.juliaX >> tile->fractal.juliaY;
+    tile->id = id;
+    tile->maxIterations = maxIterations;
+    tile->interiorChecks = interiorChecks;
+    if(stream.status() != QDataStream::Ok || type != TileMessage ||
+            formula < EscapeKernel::Mandelbrot || formula > EscapeKernel::Multibrot3)
+    {
+        return false;
+    }
+    tile->fractal.formula = EscapeKernel::Formula(formula);
+    return isValid(*tile);
+}
+
+bool TileFarm::decode(const QByteArray &message, Result *result)
+{
+    QDataStream stream(message);
+    stream.setVersion(StreamVersion);
+    quint8 type = 0;
+    qint32 id = 0;
+    stream >> type >> id >> result->iterations >> result->fractions;
+    result->id = id;
+    return stream.status() == QDataStream::Ok && type == ResultMessage;
+}
+
+bool TileFarm::takeMessage(QByteArray *buffer, QByteArray *message)
+{
+    if(buffer->size() < int(sizeof(quint32)))
+    {
+        return false;
+    }
+
+    quint32 size = 0;
+    QDataStream stream(*buffer);
+    stream.setVersion(StreamVersion);
+    stream >> size;
+    //Garbage on the socket, the empty message fails to decode
+    if(size > MaxMessageBytes)
+    {
+        buffer->clear();
+        message->clear();
+        return true;
+    }
+    if(buffer->size() - int(sizeof(quint32)) < int(size))
+    {
+        return false;
+    }
+
+    *message = buffer->mid(int(sizeof(quint32)), int(size));
+    buffer->remove(0, int(sizeof(quint32)) + int(size));
+    return true;
+}
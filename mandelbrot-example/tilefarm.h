@@ -0,0 +1,112 @@
+#ifndef TILEFARM_H
+#define TILEFARM_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QMutex>
+#include <QRect>
+#include <QSharedPointer>
+#include <QSize>
+#include <QStringList>
+#include <QVector>
+#include <functional>
+
+#include "escapekernel.h"
+#include "fixedpoint.h"
+#include "perturbation.h"
+
+//Distributes the tiles of a batch render over mandelbrot-worker processes,
+//which listen on a local socket or a TCP port, on this or other machines.
+//Every worker gets a few tiles at a time and the next one whenever it
+//answers, so fast workers take more of them. Tiles of a worker which fails,
+//disconnects or stops answering go to the others.
+class TileFarm : public QObject
+{
+    Q_OBJECT
+public:
+    //Workers refuse tiles of more steps, so a tile can not hold up a thread
+    //of theirs for good
+    enum {MaxIterations = 1 << 20};
+
+    //Rectangle of an image, pixel positions follow the conventions of RenderThread
+    struct Tile
+    {
+        int id = 0;
+        FixedPoint centerX;
+        FixedPoint centerY;
+        double scaleFactor = 0;
+        QSize imageSize;
+        QRect rect;
+        int maxIterations = 0;
+        int interiorChecks = 0;
+        EscapeKernel::Fractal fractal;
+    };
+
+    //Counts and fractions of the pixels of the tile, row by row
+    struct Result
+    {
+        int id = 0;
+        QVector<int> iterations;
+        QVector<quint8> fractions;
+    };
+
+    struct Stats
+    {
+        qint64 tiles = 0;
+        //Tiles sent again after their worker failed
+        qint64 retries = 0;
+        int failedWorkers = 0;
+        //Tiles of each worker, in the order of the addresses
+        QVector<qint64> workerTiles;
+        //Address and reason of every failed worker
+        QStringList failures;
+    };
+
+    //Reference orbits of the deep zoom tiles, one for all tiles of a view.
+    //Thread safe.
+    class OrbitCache
+    {
+    public:
+        QSharedPointer<const Perturbation::ReferenceOrbit> orbit(const Tile& tile);
+
+    private:
+        QMutex mutex;
+        FixedPoint centerX;
+        FixedPoint centerY;
+        int fractionLimbs = 0;
+        int length = 0;
+        QSharedPointer<const Perturbation::ReferenceOrbit> cached;
+    };
+
+    //Addresses are names of local servers or host:port
+    explicit TileFarm(const QStringList& workers, QObject* parent = nullptr);
+
+    //Computes the tiles on the workers and hands each result to resultReady,
+    //in the order they arrive. Runs an event loop in the calling thread until
+    //every tile is done, a tile failed too often, no worker is left or
+    //isCancelled returns true.
+    bool render(const QVector<Tile>& tiles, const std::function<void(const Result&)>& resultReady,
+                const std::function<bool()>& isCancelled, QString* error);
+    Stats stats() const;
+
+    //What the workers compute for a tile, with the kernels of RenderThread
+    static Result compute(const Tile& tile, OrbitCache* orbits);
+    //Whether the workers accept the tile. Its result has to fit one message.
+    static bool isValid(const Tile& tile);
+
+    //Messages on the sockets are a length followed by a serialized tile or result
+    static QByteArray encode(const Tile& tile);
+    static QByteArray encode(const Result& result);
+    static bool decode(const QByteArray& message, Tile* tile);
+    static bool decode(const QByteArray& message, Result* result);
+    //Takes the next complete message off the data read so far
+    static bool takeMessage(QByteArray* buffer, QByteArray* message);
+
+private:
+    struct Worker;
+
+    QStringList addresses;
+    Stats counters;
+};
+
+#endif // TILEFARM_H
@@ -0,0 +1,292 @@
+#include "tilestore.h"
+
+#include "escapekernel.h"
+
+#include <QMutexLocker>
+#include <cstddef>
+#include <cstring>
+#include <climits>
+
+namespace
+{
+const char Magic[8] = {'M', 'B', 'T', 'I', 'L', 'E', 'S', '\0'};
+const quint32 Version = 1;
+//Fields are in native byte order, a file of another machine fails this
+const quint32 ByteOrderMark = 0x01020304;
+//Slots of a set, a tile can only go into the set its key hashes to
+const int Ways = 8;
+//Slots start behind the header
+const qint64 HeaderBytes = 64;
+const int TilePixels = TileStore::TileSize * TileStore::TileSize;
+
+//FNV-1a, enough to find torn writes and damaged sectors
+quint32 checksum(const void* data, size_t size, quint32 hash = 2166136261u)
+{
+    const uchar* bytes = static_cast<const uchar*>(data);
+    for(size_t i = 0; i < size; ++i)
+    {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+}
+
+struct TileStore::Header
+{
+    char magic[8];
+    quint32 version;
+    quint32 byteOrder;
+    quint32 tileSize;
+    quint32 slotCount;
+    //Of the fields above
+    quint32 checksum;
+    //Counts up with every use, slots keep the value of their last use
+    quint32 clock;
+};
+
+struct TileStore::Slot
+{
+    uchar key[KeyBytes];
+    //Zero in an empty slot
+    qint32 maxIterations;
+    quint32 lastUse;
+    //Of key, maxIterations and the tile, written last
+    quint32 checksum;
+    quint32 reserved;
+    qint32 iterations[TilePixels];
+    quint8 fractions[TilePixels];
+
+    quint32 contentChecksum() const
+    {
+        const quint32 hash = ::checksum(key, sizeof(key) + sizeof(maxIterations));
+        return ::checksum(fractions, sizeof(fractions), ::checksum(iterations, sizeof(iterations), hash));
+    }
+};
+
+TileStore::TileStore()
+{
+    static_assert(sizeof(Header) <= HeaderBytes, "Header overlaps the slots");
+}
+
+TileStore::~TileStore()
+{
+    close();
+}
+
+bool TileStore::open(const QString &fileName, qint64 maxBytes, QString *error)
+{
+    QMutexLocker locker(&mutex);
+    unmap();
+
+    const qint64 slotTotal = qMin<qint64>((maxBytes - HeaderBytes) / qint64(sizeof(Slot)), INT_MAX) / Ways * Ways;
+    if(slotTotal <= 0)
+    {
+        *error = QStringLiteral("Not enough space for a set of tiles");
+        return false;
+    }
+
+    //Another process would change the file under the mapping of this one
+    lock.reset(new QLockFile(fileName + QLatin1String(".lock")));
+    if(!lock->tryLock(0))
+    {
+        *error = QStringLiteral("In use by another process");
+        lock.reset();
+        return false;
+    }
+
+    file.setFileName(fileName);
+    if(!file.open(QIODevice::ReadWrite))
+    {
+        *error = file.errorString();
+        unmap();
+        return false;
+    }
+
+    const qint64 size = HeaderBytes + slotTotal * qint64(sizeof(Slot));
+    Header header;
+    bool valid = file.size() == size &&
+            file.read(reinterpret_cast<char*>(&header), sizeof(header)) == qint64(sizeof(header));
+    valid = valid && std::memcmp(header.magic, Magic, sizeof(Magic)) == 0 && header.version == Version &&
+            header.byteOrder == ByteOrderMark && header.tileSize == TileSize && header.slotCount == quint32(slotTotal) &&
+            header.checksum == checksum(&header, offsetof(Header, checksum));
+    if(!valid)
+    {
+        //Resizing fills the file with zeros, which are empty slots
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, Magic, sizeof(Magic));
+        header.version = Version;
+        header.byteOrder = ByteOrderMark;
+        header.tileSize = TileSize;
+        header.slotCount = quint32(slotTotal);
+        header.checksum = checksum(&header, offsetof(Header, checksum));
+        if(!file.resize(0) || !file.resize(size) || !file.seek(0) ||
+                file.write(reinterpret_cast<const char*>(&header), sizeof(header)) != qint64(sizeof(header)) ||
+                !file.flush())
+        {
+            *error = file.errorString();
+            unmap();
+            return false;
+        }
+    }
+
+    memory = file.map(0, size);
+    if(!memory)
+    {
+        *error = file.errorString();
+        unmap();
+        return false;
+    }
+    slotCount = int(slotTotal);
+    counters.bytes = size;
+    return true;
+}
+
+void TileStore::close()
+{
+    QMutexLocker locker(&mutex);
+    unmap();
+}
+
+bool TileStore::isOpen() const
+{
+    QMutexLocker locker(&mutex);
+    return memory;
+}
+
+bool TileStore::find(const QByteArray &key, int maxIterations, QVector<int> *iterations, QVector<quint8> *fractions)
+{
+    QMutexLocker locker(&mutex);
+    if(!memory)
+    {
+        return false;
+    }
+
+    Slot* found = findSlot(key);
+    if(!found || found->maxIterations < maxIterations)
+    {
+        ++counters.misses;
+        return false;
+    }
+    if(found->checksum != found->contentChecksum())
+    {
+        found->maxIterations = 0;
+        ++counters.corrupt;
+        ++counters.misses;
+        return false;
+    }
+
+    ++counters.hits;
+    found->lastUse = ++header()->clock;
+
+    //Pixels which escaped later than this pass allows did not escape in it
+    const int stepLimit = EscapeKernel::stepLimit(maxIterations);
+    iterations->resize(TilePixels);
+    fractions->resize(TilePixels);
+    for(int k = 0; k < TilePixels; ++k)
+    {
+        const bool escaped = found->iterations[k] < stepLimit;
+        (*iterations)[k] = escaped ? found->iterations[k] : stepLimit;
+        (*fractions)[k] = escaped ? found->fractions[k] : 0;
+    }
+    return true;
+}
+
+void TileStore::insert(const QByteArray &key, int maxIterations, const QVector<int> &iterations,
+                       const QVector<quint8> &fractions)
+{
+    if(key.size() != KeyBytes || iterations.size() != TilePixels || fractions.size() != TilePixels)
+    {
+        return;
+    }
+
+    QMutexLocker locker(&mutex);
+    if(!memory)
+    {
+        return;
+    }
+
+    Slot* target = findSlot(key);
+    if(target && target->maxIterations > maxIterations && target->checksum == target->contentChecksum())
+    {
+        return;
+    }
+    if(!target)
+    {
+        //Empty slot of the set or the one used longest ago
+        const int first = firstSlot(key);
+        target = slot(first);
+        for(int i = 0; i < Ways && target->maxIterations > 0; ++i)
+        {
+            Slot* candidate = slot(first + i);
+            if(candidate->maxIterations == 0 || candidate->lastUse < target->lastUse)
+            {
+                target = candidate;
+            }
+        }
+    }
+
+    //Slot is empty while it is written, a crash leaves a wrong checksum at worst
+    target->maxIterations = 0;
+    std::memcpy(target->key, key.constData(), KeyBytes);
+    std::memcpy(target->iterations, iterations.constData(), sizeof(target->iterations));
+    std::memcpy(target->fractions, fractions.constData(), sizeof(target->fractions));
+    target->maxIterations = maxIterations;
+    target->lastUse = ++header()->clock;
+    target->checksum = target->contentChecksum();
+}
+
+TileStore::Stats TileStore::stats() const
+{
+    QMutexLocker locker(&mutex);
+    return counters;
+}
+
+void TileStore::unmap()
+{
+    if(memory)
+    {
+        file.unmap(memory);
+        memory = nullptr;
+    }
+    file.close();
+    lock.reset();
+    slotCount = 0;
+    counters.bytes = 0;
+}
+
+TileStore::Header *TileStore::header() const
+{
+    return reinterpret_cast<Header*>(memory);
+}
+
+TileStore::Slot *TileStore::slot(int index) const
+{
+    return reinterpret_cast<Slot*>(memory + HeaderBytes + qint64(index) * qint64(sizeof(Slot)));
+}
+
+int TileStore::firstSlot(const QByteArray &key) const
+{
+    //Keys are digests, any of their bytes are evenly spread
+    quint64 hash;
+    std::memcpy(&hash, key.constData(), sizeof(hash));
+    return int(hash % quint64(slotCount / Ways)) * Ways;
+}
+
+TileStore::Slot *TileStore::findSlot(const QByteArray &key) const
+{
+    if(key.size() != KeyBytes)
+    {
+        return nullptr;
+    }
+
+    const int first = firstSlot(key);
+    for(int i = 0; i < Ways; ++i)
+    {
+        Slot* candidate = slot(first + i);
+        if(candidate->maxIterations > 0 && std::memcmp(candidate->key, key.constData(), KeyBytes) == 0)
+        {
+            return candidate;
+        }
+    }
+    return nullptr;
+}
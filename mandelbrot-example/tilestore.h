@@ -0,0 +1,73 @@
+#ifndef TILESTORE_H
+#define TILESTORE_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QLockFile>
+#include <QMutex>
+#include <QScopedPointer>
+#include <QString>
+#include <QVector>
+
+//Tiles of iteration counts in a memory mapped file, so they outlive the
+//process. The file has a fixed number of slots, which bounds its size. A tile
+//goes into one of the few slots of the set its key hashes to and replaces the
+//least recently used tile there. Opening the file reads nothing, the pages of
+//a tile are loaded when it is looked up. Every slot carries a checksum, a
+//damaged or half written one is a miss. All members are thread safe.
+class TileStore
+{
+public:
+    //Edge of the square tiles, in pixels
+    enum {TileSize = 32};
+
+    //Length of the keys, e.g. an MD5 digest
+    enum {KeyBytes = 16};
+
+    struct Stats
+    {
+        qint64 hits = 0;
+        qint64 misses = 0;
+        //Slots which failed their checksum, they are emptied
+        qint64 corrupt = 0;
+        qint64 bytes = 0;
+    };
+
+    TileStore();
+    ~TileStore();
+
+    //Maps the file and creates it again when it is missing, damaged, of
+    //another version or of another size. Only one process can have it open,
+    //the others get no store.
+    bool open(const QString& fileName, qint64 maxBytes, QString* error);
+    void close();
+    bool isOpen() const;
+
+    //Key identifies a tile apart from its iterations. Tiles of more iterations
+    //serve fewer, their counts are cut to the step limit.
+    bool find(const QByteArray& key, int maxIterations, QVector<int>* iterations, QVector<quint8>* fractions);
+    //Keeps the tile of the key with the most iterations
+    void insert(const QByteArray& key, int maxIterations, const QVector<int>& iterations,
+                const QVector<quint8>& fractions);
+
+    Stats stats() const;
+
+private:
+    struct Header;
+    struct Slot;
+
+    void unmap();
+    Header* header() const;
+    Slot* slot(int index) const;
+    int firstSlot(const QByteArray& key) const;
+    Slot* findSlot(const QByteArray& key) const;
+
+    mutable QMutex mutex;
+    QFile file;
+    QScopedPointer<QLockFile> lock;
+    uchar* memory = nullptr;
+    int slotCount = 0;
+    Stats counters;
+};
+
+#endif // TILESTORE_H
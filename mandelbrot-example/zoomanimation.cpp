@@ -0,0 +1,545 @@
+#include "zoomanimation.h"
+
+#include "perturbation.h"
+
+#include <QDir>
+#include <QImage>
+#include <QVector>
+#include <QRect>
+#include <QElapsedTimer>
+#include <QMutexLocker>
+#include <QWaitCondition>
+#include <cmath>
+#include <algorithm>
+
+namespace
+{
+//Pixels per kernel call, limits the buffer of the escape magnitudes
+const int MagnitudeChunk = 256;
+
+//Frames a worker renders one after the other, every frame but the first
+//takes the interior of the set from the frame before
+const int RunLength = 8;
+
+//Blocks of a frame with a previous one have their border computed first
+const int BlockSize = 16;
+
+//Frames waiting between two stages, per thread of the following stage
+const int QueuedFrames = 2;
+
+//Animations zoom into the Mandelbrot set, the one formula with deep zoom
+const EscapeKernel::Fractal Mandelbrot;
+
+QString frameFileName(const QString& directory, int index, const QString& format)
+{
+    return QDir(directory).filePath(QStringLiteral("frame%1.%2").arg(index, 5, 10, QLatin1Char('0')).arg(format));
+}
+}
+
+//Pixel positions and kernel of one frame
+struct ZoomAnimation::FrameView
+{
+    QSize size;
+    double centerX = 0;
+    double centerY = 0;
+    double scaleFactor = 0;
+    EscapeKernel::Precision precision = EscapeKernel::DoublePrecision;
+    //Float and double kernel, double-double rows take the wide centers
+    EscapeKernel::RowFunction kernel = nullptr;
+    DoubleDouble wideCenterX;
+    DoubleDouble wideCenterY;
+    int interiorChecks = 0;
+    //Set in deep zoom, pixels are then computed off the reference orbit
+    const Perturbation::ReferenceOrbit* orbit = nullptr;
+};
+
+//Iteration counts of a computed frame, on their way to the colorizer and
+//kept by the worker for the next frame of its run
+struct ZoomAnimation::Frame
+{
+    int index = -1;
+    FixedPoint centerX;
+    FixedPoint centerY;
+    double scaleFactor = 0;
+    QVector<int> iterations;
+    QVector<quint8> fractions;
+};
+
+struct ZoomAnimation::Job
+{
+    QString directory;
+    View from;
+    View to;
+    int frameCount = 0;
+    QSize size;
+    EscapeKernel::InstructionSet instructionSet = EscapeKernel::Scalar;
+    int interiorChecks = 0;
+    int maxIterations = 0;
+    Palette palette;
+    QString format;
+    bool reuse = true;
+
+    int runCount = 0;
+    QAtomicInt nextRun;
+
+    //Computed frames in any order, the render thread colors them
+    QMutex queueMutex;
+    QWaitCondition queueChanged;
+    QVector<Frame> queue;
+    int queueCapacity = 0;
+    int activeWorkers = 0;
+    Stats counters;
+
+    //Colored frames the writers did not finish yet
+    QMutex writeMutex;
+    QWaitCondition writeFinished;
+    int pendingWrites = 0;
+    int writeCapacity = 0;
+    int writtenFrames = 0;
+    QString writeError;
+
+    //Scale changes by the same factor from frame to frame, the center moves
+    //with the scale, so the end center approaches the middle of the screen
+    //at an even pace
+    View view(int index) const
+    {
+        const double t = frameCount > 1 ? double(index) / (frameCount - 1) : 0;
+        View view;
+        view.scaleFactor = index == frameCount - 1 ? to.scaleFactor :
+                                                     from.scaleFactor * std::pow(to.scaleFactor / from.scaleFactor, t);
+        const double weight = from.scaleFactor != to.scaleFactor ?
+                    (from.scaleFactor - view.scaleFactor) / (from.scaleFactor - to.scaleFactor) : t;
+        view.centerX = from.centerX + ((to.centerX - from.centerX) * FixedPoint(weight));
+        view.centerY = from.centerY + ((to.centerY - from.centerY) * FixedPoint(weight));
+        return view;
+    }
+};
+
+ZoomAnimation::ZoomAnimation(QObject* parent) : QThread(parent),
+    kernelInstructionSet(EscapeKernel::bestInstructionSet())
+{
+    writers.setMaxThreadCount(2);
+}
+
+ZoomAnimation::~ZoomAnimation()
+{
+    cancel();
+    wait();
+}
+
+bool ZoomAnimation::renderAnimation(const QString& directory, const View& from, const View& to, int frameCount,
+                                    QSize size)
+{
+    QMutexLocker lock(&mutex);
+    if(isRunning() || size.isEmpty() || frameCount < 1 || from.scaleFactor <= 0 || to.scaleFactor <= 0)
+    {
+        return false;
+    }
+
+    this->directory = directory;
+    this->from = from;
+    this->to = to;
+    this->frameCount = frameCount;
+    this->size = size;
+    counters = Stats();
+    abort.storeRelaxed(0);
+    start(LowPriority);
+    return true;
+}
+
+void ZoomAnimation::cancel()
+{
+    abort.storeRelaxed(1);
+}
+
+void ZoomAnimation::setThreadCount(int threadCount)
+{
+    pool.setMaxThreadCount(qMax(1, threadCount));
+}
+
+void ZoomAnimation::setWriterCount(int writerCount)
+{
+    writers.setMaxThreadCount(qMax(1, writerCount));
+}
+
+void ZoomAnimation::setInstructionSet(EscapeKernel::InstructionSet instructionSet)
+{
+    QMutexLocker lock(&mutex);
+    kernelInstructionSet = EscapeKernel::isSupported(instructionSet) ?
+                instructionSet : EscapeKernel::bestInstructionSet();
+}
+
+void ZoomAnimation::setInteriorChecks(int interiorChecks)
+{
+    QMutexLocker lock(&mutex);
+    kernelInteriorChecks = interiorChecks;
+}
+
+void ZoomAnimation::setMaxIterations(int maxIterations)
+{
+    QMutexLocker lock(&mutex);
+    this->maxIterations = qMax(1, maxIterations);
+}
+
+void ZoomAnimation::setPalette(const Palette& palette)
+{
+    QMutexLocker lock(&mutex);
+    this->palette = palette;
+}
+
+void ZoomAnimation::setImageFormat(const QString& format)
+{
+    QMutexLocker lock(&mutex);
+    this->format = format;
+}
+
+void ZoomAnimation::setFrameReuse(bool reuse)
+{
+    QMutexLocker lock(&mutex);
+    this->reuse = reuse;
+}
+
+ZoomAnimation::Stats ZoomAnimation::stats() const
+{
+    QMutexLocker lock(&mutex);
+    return counters;
+}
+
+void ZoomAnimation::run()
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    mutex.lock();
+    Job job;
+    job.directory = directory;
+    job.from = from;
+    job.to = to;
+    job.frameCount = frameCount;
+    job.size = size;
+    job.instructionSet = kernelInstructionSet;
+    job.interiorChecks = kernelInteriorChecks;
+    job.maxIterations = maxIterations;
+    job.palette = palette;
+    job.format = format;
+    job.reuse = reuse;
+    mutex.unlock();
+
+    if(!QDir().mkpath(job.directory))
+    {
+        emit animationFailed(job.directory, tr("Could not create the directory"));
+        return;
+    }
+
+    job.runCount = (job.frameCount + RunLength - 1) / RunLength;
+    const int workers = qMin(pool.maxThreadCount(), job.runCount);
+    job.activeWorkers = workers;
+    job.queueCapacity = QueuedFrames * workers;
+    job.writeCapacity = QueuedFrames * writers.maxThreadCount();
+    for(int i = 0; i < workers; ++i)
+    {
+        pool.start([this, &job]()
+        {
+            QThread::currentThread()->setPriority(QThread::LowPriority);
+            renderRuns(job);
+        });
+    }
+
+    const int width = job.size.width();
+    forever
+    {
+        Frame frame;
+        {
+            QMutexLocker lock(&job.queueMutex);
+            while(job.queue.isEmpty() && job.activeWorkers > 0 && !isCancelled())
+            {
+                job.queueChanged.wait(&job.queueMutex);
+            }
+            //Wakes workers which wait for room in the queue after a cancel
+            job.queueChanged.wakeAll();
+            if(job.queue.isEmpty() || isCancelled())
+            {
+                break;
+            }
+            frame = job.queue.takeFirst();
+        }
+
+        QImage image(job.size, QImage::Format_RGB32);
+        for(int y = 0; y < job.size.height(); ++y)
+        {
+            job.palette.colorize(frame.iterations.constData() + y * width, frame.fractions.constData() + y * width,
+                                 width, job.maxIterations, reinterpret_cast<uint*>(image.scanLine(y)));
+        }
+
+        {
+            QMutexLocker lock(&job.writeMutex);
+            while(job.pendingWrites >= job.writeCapacity && !isCancelled())
+            {
+                job.writeFinished.wait(&job.writeMutex);
+            }
+            ++job.pendingWrites;
+        }
+
+        const QString fileName = frameFileName(job.directory, frame.index, job.format);
+        writers.start([this, &job, image, fileName]()
+        {
+            const bool saved = image.save(fileName, job.format.toLatin1().constData());
+            job.writeMutex.lock();
+            --job.pendingWrites;
+            const int written = saved ? ++job.writtenFrames : job.writtenFrames;
+            if(!saved && job.writeError.isEmpty())
+            {
+                job.writeError = tr("Could not write %1").arg(fileName);
+                cancel();
+            }
+            job.writeFinished.wakeAll();
+            job.writeMutex.unlock();
+
+            if(saved)
+            {
+                emit progress(written, job.frameCount);
+            }
+        });
+    }
+
+    pool.waitForDone();
+    writers.waitForDone();
+
+    mutex.lock();
+    counters = job.counters;
+    counters.frames = job.writtenFrames;
+    counters.nsecs = timer.nsecsElapsed();
+    mutex.unlock();
+
+    if(!job.writeError.isEmpty() || isCancelled())
+    {
+        emit animationFailed(job.directory, job.writeError.isEmpty() ? tr("Cancelled") : job.writeError);
+        return;
+    }
+
+    emit animationWritten(job.directory);
+}
+
+void ZoomAnimation::renderRuns(Job& job)
+{
+    Stats counters;
+    forever
+    {
+        const int run = job.nextRun.fetchAndAddRelaxed(1);
+        if(run >= job.runCount || isCancelled())
+        {
+            break;
+        }
+
+        Frame previous;
+        const int end = qMin(job.frameCount, (run + 1) * RunLength);
+        for(int index = run * RunLength; index < end && !isCancelled(); ++index)
+        {
+            const Frame frame = renderFrame(job, index, previous, &counters);
+            if(isCancelled())
+            {
+                break;
+            }
+
+            QMutexLocker lock(&job.queueMutex);
+            if(job.queue.size() >= job.queueCapacity)
+            {
+                QElapsedTimer stall;
+                stall.start();
+                while(job.queue.size() >= job.queueCapacity && !isCancelled())
+                {
+                    job.queueChanged.wait(&job.queueMutex);
+                }
+                counters.stallNsecs += stall.nsecsElapsed();
+            }
+            job.queue.append(frame);
+            job.queueChanged.wakeAll();
+            previous = frame;
+        }
+    }
+
+    QMutexLocker lock(&job.queueMutex);
+    job.counters.pixels += counters.pixels;
+    job.counters.computedPixels += counters.computedPixels;
+    job.counters.reusedPixels += counters.reusedPixels;
+    job.counters.stallNsecs += counters.stallNsecs;
+    --job.activeWorkers;
+    job.queueChanged.wakeAll();
+}
+
+ZoomAnimation::Frame ZoomAnimation::renderFrame(const Job& job, int index, const Frame& previous, Stats* counters)
+{
+    const View view = job.view(index);
+    const int width = job.size.width();
+    const int height = job.size.height();
+
+    FrameView frameView;
+    frameView.size = job.size;
+    frameView.centerX = view.centerX.toDouble();
+    frameView.centerY = view.centerY.toDouble();
+    frameView.scaleFactor = view.scaleFactor;
+    frameView.precision = EscapeKernel::precisionFor(frameView.centerX, frameView.centerY, view.scaleFactor,
+                                                     width, height, job.maxIterations);
+    frameView.kernel = EscapeKernel::rowFunction(job.instructionSet, frameView.precision);
+    frameView.wideCenterX = view.centerX.toDoubleDouble();
+    frameView.wideCenterY = view.centerY.toDoubleDouble();
+    frameView.interiorChecks = job.interiorChecks;
+
+    Perturbation::ReferenceOrbit orbit;
+    if(view.scaleFactor < Perturbation::DeepZoomScale)
+    {
+        //Reference orbit needs the precision of the center and of the pixel steps
+        const int fractionLimbs = qMax(qMax(view.centerX.fractionLimbs(), view.centerY.fractionLimbs()),
+                                       FixedPoint::fractionLimbsFor(view.scaleFactor));
+        orbit.reset(view.centerX, view.centerY, fractionLimbs);
+        orbit.extend(EscapeKernel::stepLimit(job.maxIterations) + 2, [this]() { return isCancelled(); });
+        frameView.orbit = &orbit;
+    }
+
+    Frame frame;
+    frame.index = index;
+    frame.centerX = view.centerX;
+    frame.centerY = view.centerY;
+    frame.scaleFactor = view.scaleFactor;
+    frame.iterations.resize(width * height);
+    frame.fractions.resize(width * height);
+    int* iterations = frame.iterations.data();
+    quint8* fractions = frame.fractions.data();
+    counters->pixels += qint64(width) * height;
+
+    if(!job.reuse || previous.index < 0)
+    {
+        for(int y = 0; y < height && !isCancelled(); ++y)
+        {
+            computeSpan(frameView, 0, y, width, job.maxIterations, iterations + y * width, fractions + y * width);
+        }
+        counters->computedPixels += qint64(width) * height;
+        return frame;
+    }
+
+    //Position of a pixel in the previous frame is its position in this one
+    //times ratio, plus shift
+    const double ratio = view.scaleFactor / previous.scaleFactor;
+    const double shiftX = (view.centerX - previous.centerX).toDouble() / previous.scaleFactor;
+    const double shiftY = (view.centerY - previous.centerY).toDouble() / previous.scaleFactor;
+    const int* previousIterations = previous.iterations.constData();
+    const QRect frameRect(0, 0, width, height);
+
+    for(int top = 0; top < height && !isCancelled(); top += BlockSize)
+    {
+        for(int left = 0; left < width; left += BlockSize)
+        {
+            const QRect block = QRect(left, top, BlockSize, BlockSize) & frameRect;
+            auto compute = [&](int x, int y, int count)
+            {
+                computeSpan(frameView, x, y, count, job.maxIterations, iterations + y * width + x,
+                            fractions + y * width + x);
+                counters->computedPixels += count;
+            };
+
+            if(block.width() <= 2 || block.height() <= 2)
+            {
+                for(int y = block.top(); y <= block.bottom(); ++y)
+                {
+                    compute(block.left(), y, block.width());
+                }
+                continue;
+            }
+
+            compute(block.left(), block.top(), block.width());
+            compute(block.left(), block.bottom(), block.width());
+            for(int y = block.top() + 1; y < block.bottom(); ++y)
+            {
+                compute(block.left(), y, 1);
+                compute(block.right(), y, 1);
+            }
+
+            //The set has no holes, a border inside of it encloses only the
+            //set. Sampled borders can miss thin filaments, so the pixels of
+            //the previous frame under the block have to be inside as well.
+            bool inside = true;
+            for(int y = block.top(); y <= block.bottom() && inside; ++y)
+            {
+                const int* row = iterations + y * width;
+                const bool edge = y == block.top() || y == block.bottom();
+                for(int x = block.left(); x <= block.right(); x += edge ? 1 : block.width() - 1)
+                {
+                    inside = inside && row[x] >= job.maxIterations;
+                }
+            }
+
+            const int previousLeft = int(std::floor((block.left() + 1 - width / 2) * ratio + shiftX)) + width / 2;
+            const int previousRight = int(std::ceil((block.right() - 1 - width / 2) * ratio + shiftX)) + width / 2;
+            const int previousTop = int(std::floor((block.top() + 1 - height / 2) * ratio + shiftY)) + height / 2;
+            const int previousBottom = int(std::ceil((block.bottom() - 1 - height / 2) * ratio + shiftY)) + height / 2;
+            inside = inside && frameRect.contains(QRect(QPoint(previousLeft, previousTop),
+                                                        QPoint(previousRight, previousBottom)));
+            for(int y = previousTop; y <= previousBottom && inside; ++y)
+            {
+                for(int x = previousLeft; x <= previousRight && inside; ++x)
+                {
+                    inside = previousIterations[y * width + x] >= job.maxIterations;
+                }
+            }
+
+            for(int y = block.top() + 1; y < block.bottom(); ++y)
+            {
+                if(inside)
+                {
+                    std::fill_n(iterations + y * width + block.left() + 1, block.width() - 2, job.maxIterations);
+                    std::fill_n(fractions + y * width + block.left() + 1, block.width() - 2, quint8(0));
+                    counters->reusedPixels += block.width() - 2;
+                }
+                else
+                {
+                    compute(block.left() + 1, y, block.width() - 2);
+                }
+            }
+        }
+    }
+    return frame;
+}
+
+void ZoomAnimation::computeSpan(const FrameView& view, int x, int y, int count, int maxIterations,
+                                int* iterations, quint8* fractions)
+{
+    const int stepLimit = EscapeKernel::stepLimit(maxIterations);
+    float magnitudes[MagnitudeChunk];
+
+    //Same pixel positions as the interactive render, relative to the center
+    const int row = y - view.size.height() / 2;
+    const double ay = view.centerY + (row * view.scaleFactor);
+    const DoubleDouble wideAy = view.wideCenterY + (DoubleDouble(row) * DoubleDouble(view.scaleFactor));
+    for(int done = 0; done < count; done += MagnitudeChunk)
+    {
+        const int chunk = qMin(MagnitudeChunk, count - done);
+        const int column = x + done - view.size.width() / 2;
+        int* chunkIterations = iterations + done;
+        if(view.orbit)
+        {
+            int rebases = 0;
+            Perturbation::row(*view.orbit, view.scaleFactor, column, row, chunk, maxIterations, chunkIterations,
+                              magnitudes, &rebases);
+        }
+        else if(view.precision == EscapeKernel::DoubleDoublePrecision)
+        {
+            EscapeKernel::doubleDoubleRow(view.wideCenterX, view.scaleFactor, column, wideAy, chunk, maxIterations,
+                                          view.interiorChecks, chunkIterations, magnitudes, nullptr, Mandelbrot);
+        }
+        else
+        {
+            view.kernel(view.centerX, view.scaleFactor, column, ay, chunk, maxIterations, view.interiorChecks,
+                        chunkIterations, magnitudes, nullptr, Mandelbrot);
+        }
+
+        for(int k = 0; k < chunk; ++k)
+        {
+            fractions[done + k] = chunkIterations[k] < stepLimit ? Palette::fraction(magnitudes[k]) : 0;
+        }
+    }
+}
+
+bool ZoomAnimation::isCancelled() const
+{
+    return abort.loadRelaxed();
+}
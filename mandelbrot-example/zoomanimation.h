@@ -0,0 +1,108 @@
+#ifndef ZOOMANIMATION_H
+#define ZOOMANIMATION_H
+
+#include <QThread>
+#include <QMutex>
+#include <QSize>
+#include <QString>
+#include <QThreadPool>
+#include <QAtomicInt>
+
+#include "escapekernel.h"
+#include "fixedpoint.h"
+#include "palette.h"
+
+//Renders a zoom from one view to another as numbered image files, for
+//videos. The scale changes by the same factor from frame to frame. Runs of
+//consecutive frames are computed in parallel, the render thread colors the
+//finished frames and a pool of writers encodes them, so slow disks only
+//hold up the compute workers once the queue between them is full.
+class ZoomAnimation : public QThread
+{
+    Q_OBJECT
+public:
+    struct View
+    {
+        FixedPoint centerX;
+        FixedPoint centerY;
+        double scaleFactor = 0;
+    };
+
+    struct Stats
+    {
+        int frames = 0;
+        qint64 pixels = 0;
+        qint64 computedPixels = 0;
+        //Inside of the set in the previous frame of the run and on the
+        //border of their block in this one, filled in without computing
+        qint64 reusedPixels = 0;
+        //Compute workers waited for the queue to the writers
+        qint64 stallNsecs = 0;
+        qint64 nsecs = 0;
+    };
+
+    explicit ZoomAnimation(QObject* parent = nullptr);
+    ~ZoomAnimation();
+
+    //Starts writing frame00000.<format> and the following frames into the
+    //directory, returns false while an animation is still running. Pixel
+    //positions follow the conventions of RenderThread.
+    bool renderAnimation(const QString& directory, const View& from, const View& to, int frameCount, QSize size);
+    //Stops the running animation, frames already written stay
+    void cancel();
+
+    //Settings apply to the next animation
+    void setThreadCount(int threadCount);
+    void setWriterCount(int writerCount);
+    void setInstructionSet(EscapeKernel::InstructionSet instructionSet);
+    void setInteriorChecks(int interiorChecks);
+    void setMaxIterations(int maxIterations);
+    void setPalette(const Palette& palette);
+    //Any format QImageWriter supports, png by default
+    void setImageFormat(const QString& format);
+    //Takes the interior of the set from the previous frame, on by default
+    void setFrameReuse(bool reuse);
+
+    //Of the last animation, complete once it finished
+    Stats stats() const;
+
+signals:
+    //Emitted from the writers, whenever a frame was written
+    void progress(int writtenFrames, int frames);
+    void animationWritten(const QString& directory);
+    void animationFailed(const QString& directory, const QString& error);
+
+protected:
+    void run() override;
+
+private:
+    struct Job;
+    struct FrameView;
+    struct Frame;
+
+    void renderRuns(Job& job);
+    Frame renderFrame(const Job& job, int index, const Frame& previous, Stats* counters);
+    static void computeSpan(const FrameView& view, int x, int y, int count, int maxIterations, int* iterations,
+                            quint8* fractions);
+    bool isCancelled() const;
+
+private:
+    mutable QMutex mutex;
+    QThreadPool pool;
+    QThreadPool writers;
+    QString directory;
+    View from;
+    View to;
+    int frameCount = 0;
+    QSize size;
+    EscapeKernel::InstructionSet kernelInstructionSet;
+    int kernelInteriorChecks = EscapeKernel::CardioidCheck | EscapeKernel::PeriodicityCheck;
+    int maxIterations = 4096;
+    Palette palette;
+    QString format = QStringLiteral("png");
+    bool reuse = true;
+    Stats counters;
+    QAtomicInt abort;
+};
+
+#endif // ZOOMANIMATION_H
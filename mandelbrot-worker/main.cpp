@@ -0,0 +1,158 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QHash>
+#include <QHostAddress>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QSharedPointer>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QThreadPool>
+#include <QDebug>
+#include <type_traits>
+
+#include "tilefarm.h"
+
+//Computes the tiles of TileFarm for the exporter of mandelbrot-example,
+//without a GUI. Several of them may run on one machine, each listening on
+//its own local server name or port.
+int main(int argc, char** argv)
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Mandelbrot tile worker"));
+    parser.addHelpOption();
+    QCommandLineOption listenOption(QStringList() << QStringLiteral("l") << QStringLiteral("listen"),
+                                    QStringLiteral("Name of the local server to listen on."),
+                                    QStringLiteral("name"));
+    parser.addOption(listenOption);
+    QCommandLineOption portOption(QStringList() << QStringLiteral("p") << QStringLiteral("port"),
+                                  QStringLiteral("TCP port to listen on."),
+                                  QStringLiteral("port"));
+    parser.addOption(portOption);
+    QCommandLineOption bindOption(QStringList() << QStringLiteral("b") << QStringLiteral("bind"),
+                                  QStringLiteral("Address the TCP port listens on, localhost by default. Workers "
+                                                 "do not authenticate clients, so only bind them to other "
+                                                 "interfaces, e.g. 0.0.0.0, on trusted networks."),
+                                  QStringLiteral("address"));
+    parser.addOption(bindOption);
+    QCommandLineOption threadsOption(QStringList() << QStringLiteral("t") << QStringLiteral("threads"),
+                                     QStringLiteral("Number of threads computing tiles."),
+                                     QStringLiteral("count"));
+    parser.addOption(threadsOption);
+    parser.process(app);
+
+    if(!parser.isSet(listenOption) && !parser.isSet(portOption))
+    {
+        qCritical() << "Give a local server name with --listen or a port with --port";
+        return 1;
+    }
+
+    QThreadPool pool;
+    if(parser.isSet(threadsOption))
+    {
+        pool.setMaxThreadCount(qMax(1, parser.value(threadsOption).toInt()));
+    }
+    TileFarm::OrbitCache orbits;
+
+    //Results are written by the main thread, the ones of a closed
+    //connection are dropped
+    QHash<quint64, QIODevice*> connections;
+    quint64 nextConnection = 0;
+    qint64 servedTiles = 0;
+
+    auto serve = [&](auto* socket)
+    {
+        using Socket = typename std::remove_pointer<decltype(socket)>::type;
+        const quint64 connection = ++nextConnection;
+        connections.insert(connection, socket);
+        QSharedPointer<QByteArray> buffer(new QByteArray);
+
+        QObject::connect(socket, &Socket::disconnected, &app, [&connections, connection, socket]()
+        {
+            connections.remove(connection);
+            socket->deleteLater();
+        });
+        QObject::connect(socket, &Socket::readyRead, &app, [&, connection, socket, buffer]()
+        {
+            buffer->append(socket->readAll());
+            QByteArray message;
+            while(TileFarm::takeMessage(buffer.data(), &message))
+            {
+                TileFarm::Tile tile;
+                if(!TileFarm::decode(message, &tile))
+                {
+                    //Client gives the tiles it is missing to other workers
+                    qWarning() << "Malformed tile, closing the connection";
+                    socket->abort();
+                    return;
+                }
+
+                pool.start([&, connection, tile]()
+                {
+                    const QByteArray result = TileFarm::encode(TileFarm::compute(tile, &orbits));
+                    QMetaObject::invokeMethod(&app, [&, connection, result]()
+                    {
+                        if(QIODevice* target = connections.value(connection))
+                        {
+                            target->write(result);
+                            ++servedTiles;
+                        }
+                    }, Qt::QueuedConnection);
+                });
+            }
+        });
+    };
+
+    QLocalServer localServer;
+    if(parser.isSet(listenOption))
+    {
+        //Name of a worker which crashed is still taken on some platforms
+        const QString name = parser.value(listenOption);
+        QLocalServer::removeServer(name);
+        if(!localServer.listen(name))
+        {
+            qCritical().nospace() << "Can not listen on " << name << ": " << localServer.errorString();
+            return 1;
+        }
+        QObject::connect(&localServer, &QLocalServer::newConnection, &app, [&]()
+        {
+            while(QLocalSocket* socket = localServer.nextPendingConnection())
+            {
+                serve(socket);
+            }
+        });
+        qInfo().nospace() << "Listening on " << localServer.fullServerName();
+    }
+
+    QTcpServer tcpServer;
+    if(parser.isSet(portOption))
+    {
+        QHostAddress address(QHostAddress::LocalHost);
+        if(parser.isSet(bindOption) && !address.setAddress(parser.value(bindOption)))
+        {
+            qCritical().nospace() << "Invalid address " << parser.value(bindOption);
+            return 1;
+        }
+        if(!tcpServer.listen(address, quint16(parser.value(portOption).toUInt())))
+        {
+            qCritical().nospace() << "Can not listen on port " << parser.value(portOption) << ": "
+                                  << tcpServer.errorString();
+            return 1;
+        }
+        QObject::connect(&tcpServer, &QTcpServer::newConnection, &app, [&]()
+        {
+            while(QTcpSocket* socket = tcpServer.nextPendingConnection())
+            {
+                serve(socket);
+            }
+        });
+        qInfo().nospace() << "Listening on " << tcpServer.serverAddress().toString() << ":" << tcpServer.serverPort();
+    }
+
+    const int result = app.exec();
+    pool.waitForDone();
+    qInfo().nospace() << "Tiles served: " << servedTiles;
+    return result;
+}
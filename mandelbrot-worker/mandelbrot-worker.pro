@@ -0,0 +1,7 @@
+include(../mandelbrot-example/rendercore.pri)
+
+SOURCES += \
+    main.cpp
+
+CONFIG += console
+CONFIG -= app_bundle
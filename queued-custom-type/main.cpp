@@ -80,6 +80,7 @@ int main(int argc, char** argv)
 {
     QApplication a(argc, argv);
     qRegisterMetaType<Block>();
+    qRegisterMetaType<QVector<Block>>();
     Window w;
     w.resize(512,512);
     w.loadImage(createImage(512, 512));
@@ -2,6 +2,7 @@
 
 #include "block.h"
 
+#include <QElapsedTimer>
 #include <QRandomGenerator>
 
 RenderThread::RenderThread(QObject *parent) : QThread(parent)
@@ -18,9 +19,22 @@ void RenderThread::processImage(const QImage &image)
 
     m_abort = false;
     m_image = image;
+    buildSummedAreaTable();
     start();
 }
 
+void RenderThread::setBatched(bool batched)
+{
+    QMutexLocker locker(&mutex);
+    m_batched = batched;
+}
+
+void RenderThread::setBatchInterval(int msecs)
+{
+    QMutexLocker locker(&mutex);
+    m_batchInterval = qMax(1, msecs);
+}
+
 void RenderThread::stopProcess()
 {
     mutex.lock();
@@ -30,8 +44,41 @@ void RenderThread::stopProcess()
     wait();
 }
 
+void RenderThread::buildSummedAreaTable()
+{
+    //One conversion instead of one per pixel of every block
+    const QImage pixels = m_image.convertToFormat(QImage::Format_RGB32);
+    m_sumsStride = pixels.width() + 1;
+    m_sums = QVector<ChannelSums>(m_sumsStride * (pixels.height() + 1));
+    ChannelSums* sums = m_sums.data();
+
+    //Sums wrap around, the difference of four entries is still exact for
+    //blocks which sum to less than 2^32
+    for (int y = 0; y < pixels.height(); ++y)
+    {
+        const QRgb* line = reinterpret_cast<const QRgb*>(pixels.constScanLine(y));
+        const ChannelSums* above = sums + y * m_sumsStride;
+        ChannelSums* current = sums + (y + 1) * m_sumsStride;
+        ChannelSums row;
+        for (int x = 0; x < pixels.width(); ++x)
+        {
+            row.red += qRed(line[x]);
+            row.green += qGreen(line[x]);
+            row.blue += qBlue(line[x]);
+            current[x + 1].red = above[x + 1].red + row.red;
+            current[x + 1].green = above[x + 1].green + row.green;
+            current[x + 1].blue = above[x + 1].blue + row.blue;
+        }
+    }
+}
+
 void RenderThread::run()
 {
+    //One queued event and one repaint of the window per batch
+    QVector<Block> batch;
+    QElapsedTimer batchTimer;
+    batchTimer.start();
+
     int size = qMax(m_image.width()/20, m_image.height()/20);
     for (int s = size; s > 0; --s)
     {
@@ -42,32 +89,59 @@ void RenderThread::run()
             int x2 = qMin(x1 + s/2 + 1, m_image.width());
             int y1 = qMax(0, QRandomGenerator::global()->bounded(m_image.height()) - s/2);
             int y2 = qMin(y1 + s/2 + 1, m_image.height());
-            int n = 0;
-            int red = 0;
-            int green = 0;
-            int blue = 0;
+            int n = (x2 - x1) * (y2 - y1);
 
-            for (int i = y1; i < y2; ++i)
-            {
-                for (int j = x1; j < x2; ++j)
-                {
-                    QRgb pixel = m_image.pixel(j, i);
-                    red += qRed(pixel);
-                    green += qGreen(pixel);
-                    blue += qBlue(pixel);
-                    n += 1;
-                }
-            }
+            //Sums over the block from the corners of the table
+            const ChannelSums& topLeft = m_sums.at(y1 * m_sumsStride + x1);
+            const ChannelSums& topRight = m_sums.at(y1 * m_sumsStride + x2);
+            const ChannelSums& bottomLeft = m_sums.at(y2 * m_sumsStride + x1);
+            const ChannelSums& bottomRight = m_sums.at(y2 * m_sumsStride + x2);
+            int red = int(bottomRight.red - topRight.red - bottomLeft.red + topLeft.red);
+            int green = int(bottomRight.green - topRight.green - bottomLeft.green + topLeft.green);
+            int blue = int(bottomRight.blue - topRight.blue - bottomLeft.blue + topLeft.blue);
 
             Block block(QRect(x1, y1, x2 - x1 + 1, y2 - y1 + 1),
                         QColor(red/n, green/n, blue/n));
+            mutex.lock();
+            const bool batched = m_batched;
+            const int batchInterval = m_batchInterval;
+            mutex.unlock();
+
             //Block is generated, emit a signal and let main thread process the changes
-            emit sendBlock(block);
+            if (!batched)
+            {
+                emit sendBlock(block);
+            }
+            else
+            {
+                batch.append(block);
+                if (batchTimer.elapsed() >= batchInterval)
+                {
+                    emit sendBlocks(batch);
+                    batch.clear();
+                    batchTimer.restart();
+                }
+            }
             if (m_abort)
             {
+                //Blocks which were already made still reach the window
+                if (!batch.isEmpty())
+                {
+                    emit sendBlocks(batch);
+                }
                 return;
             }
-            msleep(10);
+            //The pause paces single blocks for the eye. Batches are paced by
+            //their interval, so each one carries all blocks of a frame.
+            if (!batched)
+            {
+                msleep(10);
+            }
         }
     }
+
+    if (!batch.isEmpty())
+    {
+        emit sendBlocks(batch);
+    }
 }
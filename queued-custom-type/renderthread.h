@@ -4,6 +4,7 @@
 #include <QThread>
 #include <QImage>
 #include <QMutex>
+#include <QVector>
 
 class Block;
 
@@ -14,8 +15,15 @@ public:
     RenderThread(QObject *parent = nullptr);
     void processImage(const QImage& image);
 
+    //Collects the blocks and sends them together once per interval,
+    //normally the refresh interval of the display, instead of one by one
+    void setBatched(bool batched);
+    void setBatchInterval(int msecs);
+
 signals:
     void sendBlock(const Block& block);
+    //Blocks of one interval in the order they were generated
+    void sendBlocks(const QVector<Block>& blocks);
 
 public slots:
     void stopProcess();
@@ -24,8 +32,24 @@ protected:
     void run();
 
 private:
+    //Sums of the channels over the pixels above and left of a point
+    struct ChannelSums
+    {
+        quint32 red = 0;
+        quint32 green = 0;
+        quint32 blue = 0;
+    };
+
+    void buildSummedAreaTable();
+
     bool m_abort;
+    bool m_batched = false;
+    int m_batchInterval = 16;
     QImage m_image;
+    //Entry (x, y) holds the sums over [0, x) x [0, y), with a row and a
+    //column of zeros in front, so each block average takes four lookups
+    QVector<ChannelSums> m_sums;
+    int m_sumsStride = 0;
     QMutex mutex;
 };
 
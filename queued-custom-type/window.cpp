@@ -3,6 +3,7 @@
 #include "block.h"
 #include "renderthread.h"
 
+#include <QCheckBox>
 #include <QPushButton>
 #include <QLabel>
 #include <QHBoxLayout>
@@ -24,15 +25,20 @@ Window::Window(QWidget *parent) : QWidget(parent), thread(new RenderThread(this)
     resetButton = new QPushButton(tr("&Stop"), this);
     resetButton->setEnabled(false);
 
+    batchBox = new QCheckBox(tr("&Batch blocks per frame"), this);
+
     connect(loadButton, &QPushButton::clicked, this, QOverload<>::of(&Window::loadImage));
     connect(resetButton, &QPushButton::clicked, thread, &RenderThread::stopProcess);
     connect(thread, &RenderThread::finished, this, &Window::resetUi);
     connect(thread, &RenderThread::sendBlock, this, &Window::addBlock);
+    connect(thread, &RenderThread::sendBlocks, this, &Window::addBlocks);
+    connect(batchBox, &QCheckBox::toggled, thread, &RenderThread::setBatched);
 
     QHBoxLayout* buttonLayout = new QHBoxLayout(this);
     buttonLayout->addStretch();
     buttonLayout->addWidget(loadButton);
     buttonLayout->addWidget(resetButton);
+    buttonLayout->addWidget(batchBox);
     buttonLayout->addStretch();
 
 
@@ -59,6 +65,9 @@ void Window::loadImage(const QImage &image)
         label->setPixmap(pixmap);
         loadButton->setEnabled(false);
         resetButton->setEnabled(true);
+        //A batch for every frame the display shows
+        const qreal refreshRate = QGuiApplication::primaryScreen()->refreshRate();
+        thread->setBatchInterval(int(1000 / qMax(refreshRate, qreal(1))));
         thread->processImage(useImage);
 }
 
@@ -74,6 +83,20 @@ void Window::addBlock(const Block &block)
     label->setPixmap(pixmap);
 }
 
+void Window::addBlocks(const QVector<Block> &blocks)
+{
+    QPainter painter;
+    painter.begin(&pixmap);
+    for (const Block& block : blocks)
+    {
+        QColor color{block.color()};
+        color.setAlpha(64);
+        painter.fillRect(block.rect(), color);
+    }
+    painter.end();
+    label->setPixmap(pixmap);
+}
+
 void Window::loadImage()
 {
     QStringList formats;
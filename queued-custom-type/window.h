@@ -3,6 +3,7 @@
 
 #include <QWidget>
 
+class QCheckBox;
 class QLabel;
 class QPushButton;
 class Block;
@@ -17,6 +18,7 @@ public:
 
 public slots:
     void addBlock(const Block& block);
+    void addBlocks(const QVector<Block>& blocks);
 
 private slots:
     void loadImage();
@@ -28,6 +30,7 @@ private:
     QPixmap pixmap;
     QPushButton* loadButton;
     QPushButton* resetButton;
+    QCheckBox* batchBox;
     QString path;
 
 };